@@ -1,13 +1,185 @@
-/**  Do not modify this file  **/
-
+#define _GNU_SOURCE
 #include "Bank.h"
+#include "sparse.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 
 int *BANK_accounts;	//Array for storing account values
+sparseArray *BANK_sparse;	//Or pages of them allocated as they are written
+int BANK_shared = 0;	//Set when the array is a mapped shared memory segment
 
+//Storage delay in microseconds for every read and write, can be overridden when compiling
+#ifndef WAIT_TIME
 #define WAIT_TIME 10000
+#endif
+
+//How long one storage call takes, set with set_latency
+enum { LATENCY_NONE, LATENCY_FIXED, LATENCY_UNIFORM, LATENCY_LOGNORMAL, LATENCY_HISTOGRAM };
+
+typedef struct latency_model {
+	int kind;
+	double a, b;		//fixed: a, uniform: a to b, lognormal: median a and sigma b, all in microseconds
+	double *bucket_us;	//histogram: the latency of each bucket
+	double *cumulative;	//histogram: running total of the bucket counts
+	int buckets;
+	double stall_chance;	//chance of a call taking stall_us longer
+	double stall_us;
+} latency_model;
+
+latency_model read_latency = { WAIT_TIME > 0 ? LATENCY_FIXED : LATENCY_NONE, WAIT_TIME };
+latency_model write_latency = { WAIT_TIME > 0 ? LATENCY_FIXED : LATENCY_NONE, WAIT_TIME };
+
+//Each thread draws its own random numbers so storage calls don't share any state
+__thread unsigned long long latency_seed = 0;
+
+/*
+ *  Uniform random number for the calling thread
+ *  Return:  value in (0, 1)
+ */
+double latency_random()
+{
+	if(latency_seed == 0)
+	{
+		latency_seed = (unsigned long long) &latency_seed ^ (unsigned long long) time(NULL) * 0x9E3779B97F4A7C15ULL;
+	}
+	latency_seed ^= latency_seed << 13;
+	latency_seed ^= latency_seed >> 7;
+	latency_seed ^= latency_seed << 17;
+	return ((latency_seed >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ *  Read a latency histogram file, one "microseconds count" line per bucket
+ *  Return:  1 if succeeded, 0 if error
+ */
+int load_histogram( latency_model *model, const char *path )
+{
+	FILE *in = fopen(path, "r");
+	if(in == NULL) return 0;
+
+	char line[256];
+	double us, count, total = 0;
+	while(fgets(line, sizeof(line), in))
+	{
+		if(sscanf(line, "%lf %lf", &us, &count) != 2 || us < 0 || count <= 0) continue;
+		model->bucket_us = realloc(model->bucket_us, (model->buckets+1) * sizeof(double));
+		model->cumulative = realloc(model->cumulative, (model->buckets+1) * sizeof(double));
+		total += count;
+		model->bucket_us[model->buckets] = us;
+		model->cumulative[model->buckets] = total;
+		model->buckets++;
+	}
+	fclose(in);
+	return model->buckets > 0;
+}
+
+/*
+ *  Parse a latency model
+ *  Input:  latency_model *model - model to fill in
+ *  Input:  const char *spec - the model, see set_latency
+ *  Return:  1 if succeeded, 0 if error
+ */
+int parse_latency( latency_model *model, const char *spec )
+{
+	latency_model parsed;
+	memset(&parsed, 0, sizeof(parsed));
+	char text[1024];
+	strncpy(text, spec, sizeof(text)-1);
+	text[sizeof(text)-1] = '\0';
+
+	char *stall = strstr(text, ",stall=");
+	if(stall)
+	{
+		*stall = '\0';
+		if(sscanf(stall+7, "%lf:%lf", &parsed.stall_chance, &parsed.stall_us) != 2 || parsed.stall_chance < 0 || parsed.stall_chance > 1 || parsed.stall_us < 0) return 0;
+	}
+
+	if(strcmp(text, "none") == 0)
+	{
+		parsed.kind = LATENCY_NONE;
+	}
+	else if(sscanf(text, "fixed:%lf", &parsed.a) == 1 && parsed.a >= 0)
+	{
+		parsed.kind = LATENCY_FIXED;
+	}
+	else if(sscanf(text, "uniform:%lf:%lf", &parsed.a, &parsed.b) == 2 && parsed.a >= 0 && parsed.b >= parsed.a)
+	{
+		parsed.kind = LATENCY_UNIFORM;
+	}
+	else if(sscanf(text, "lognormal:%lf:%lf", &parsed.a, &parsed.b) == 2 && parsed.a > 0 && parsed.b >= 0)
+	{
+		parsed.kind = LATENCY_LOGNORMAL;
+	}
+	else if(strncmp(text, "histogram:", 10) == 0 && load_histogram(&parsed, text+10))
+	{
+		parsed.kind = LATENCY_HISTOGRAM;
+	}
+	else return 0;
+
+	*model = parsed;
+	return 1;
+}
+
+/*
+ *  Set how long reads and writes take, NULL leaves a side as it is
+ *  Return:  1 if succeeded, 0 if a model couldn't be parsed
+ */
+int set_latency( const char *reads, const char *writes )
+{
+	if(reads && !parse_latency(&read_latency, reads)) return 0;
+	if(writes && !parse_latency(&write_latency, writes)) return 0;
+	return 1;
+}
+
+/*
+ *  Wait out one storage call under a latency model, the none model doesn't even make a system call
+ */
+void storage_delay( latency_model *model )
+{
+	double us = 0;
+	int low, high;
+	switch(model->kind)
+	{
+		case LATENCY_FIXED:
+			us = model->a;
+			break;
+		case LATENCY_UNIFORM:
+			us = model->a + (model->b - model->a) * latency_random();
+			break;
+		case LATENCY_LOGNORMAL:
+			//Box-Muller gives a standard normal from two uniform numbers
+			us = model->a * exp(model->b * sqrt(-2 * log(latency_random())) * cos(2 * M_PI * latency_random()));
+			break;
+		case LATENCY_HISTOGRAM:
+			//Find the first bucket whose running total passes a random point in the counts
+			low = 0;
+			high = model->buckets - 1;
+			double point = latency_random() * model->cumulative[high];
+			while(low < high)
+			{
+				int middle = (low + high) / 2;
+				if(model->cumulative[middle] < point) low = middle + 1;
+				else high = middle;
+			}
+			us = model->bucket_us[low];
+			break;
+	}
+	if(model->stall_chance > 0 && latency_random() < model->stall_chance)
+	{
+		us += model->stall_us;
+	}
+	if(us >= 1)
+	{
+		struct timespec wait = { (time_t) (us / 1000000), (long) (fmod(us, 1000000) * 1000) };
+		nanosleep(&wait, NULL);
+	}
+}
 
 /*
  *  Intialize back accounts
@@ -27,6 +199,69 @@ int initialize_accounts( int n )
 	return 1;
 }
 
+/*
+ *  Intialize bank accounts in a shared memory segment that another process can map
+ *  Input:  int n - Number of bank accounts
+ *  Return:  file descriptor of the segment, -1 if error
+ */
+int initialize_shared_accounts( int n )
+{
+	int fd = memfd_create("BANK_accounts", 0);
+	if(fd < 0) return -1;
+	//A new segment reads as all zeros
+	if(ftruncate(fd, sizeof(int) * (long) n) != 0 || !attach_accounts(fd, n))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ *  Use the bank accounts in a shared memory segment made by initialize_shared_accounts
+ *  Input:  int fd - File descriptor of the segment
+ *  Input:  int n - Number of bank accounts
+ *  Return:  1 if succeeded, 0 if error
+ */
+int attach_accounts( int fd, int n )
+{
+	void *mapped = mmap(NULL, sizeof(int) * (long) n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mapped == MAP_FAILED) return 0;
+	BANK_accounts = mapped;
+	BANK_shared = 1;
+	return 1;
+}
+
+/*
+ *  Intialize sparse bank accounts, only the values of accounts that are written take memory
+ *  Input:  int n - Number of bank accounts
+ *  Return:  1 if succeeded, 0 if error
+ */
+int initialize_sparse_accounts( int n )
+{
+	BANK_sparse = sparseNew(n, sizeof(int), NULL);
+	return BANK_sparse->pages != NULL;
+}
+
+/*
+ *  Stored value of an account, accounts that were never written are 0
+ */
+int stored_value( int ID )
+{
+	if(BANK_accounts) return BANK_accounts[ID - 1];
+	int *value = sparsePeek(BANK_sparse, ID - 1);
+	return value ? *value : 0;
+}
+
+/*
+ *  Where an account's value is stored, allocating it if it wasn't yet
+ */
+int * value_slot( int ID )
+{
+	if(BANK_accounts) return &BANK_accounts[ID - 1];
+	return sparseAt(BANK_sparse, ID - 1);
+}
+
 /*
  *  Read a bank account
  *  Input:  int ID - Id of bank account to read
@@ -34,8 +269,24 @@ int initialize_accounts( int n )
  */
 int read_account( int ID )
 {
-	usleep( WAIT_TIME );
-	return BANK_accounts[ID - 1];
+	storage_delay( &read_latency );
+	return stored_value(ID);
+}
+
+/*
+ *  Read a batch of bank accounts with a single storage round trip
+ *  Input:  int *IDs - Ids of the bank accounts to read
+ *  Input:  int n - Number of Ids in the batch
+ *  Output:  int *values - values[i] receives the value of account IDs[i]
+ */
+void read_accounts( int *IDs, int n, int *values )
+{
+	storage_delay( &read_latency );
+	int i;
+	for( i = 0; i < n; i++)
+	{
+		values[i] = stored_value(IDs[i]);
+	}
 }
 
 /*
@@ -45,8 +296,82 @@ int read_account( int ID )
  */
 void write_account( int ID, int value)
 {
-	usleep( WAIT_TIME );
-	BANK_accounts[ID - 1] = value;
+	storage_delay( &write_latency );
+	*value_slot(ID) = value;
+}
+
+/*
+ *  Write a batch of bank accounts with a single storage round trip
+ *  Input:  int *IDs - Ids of the bank accounts to write to
+ *  Input:  int n - Number of Ids in the batch
+ *  Input:  int *values - values[i] is written to account IDs[i]
+ */
+void write_accounts( int *IDs, int n, int *values )
+{
+	storage_delay( &write_latency );
+	int i;
+	for( i = 0; i < n; i++)
+	{
+		*value_slot(IDs[i]) = values[i];
+	}
+}
+
+/*
+ *  Direct access to the stored values, for placing or copying them without the storage delay
+ *  Return:  Pointer to the values of accounts 1 to n, account ID is at index ID - 1, NULL for sparse accounts
+ */
+int * account_storage()
+{
+	return BANK_accounts;
+}
+
+/*
+ *  Copy stored values without the storage delay
+ *  Return:  0 if none of the accounts was ever written, so they are all 0
+ */
+int copy_values( int first, int n, int *values )
+{
+	if(BANK_accounts)
+	{
+		memcpy(values, &BANK_accounts[first - 1], n * sizeof(int));
+		return 1;
+	}
+	//A page at a time, a page that was never written is all zero
+	int i = 0, written = 0;
+	while(i < n)
+	{
+		long index = first - 1 + i;
+		int inPage = SPARSE_PAGE_ENTRIES - (index & (SPARSE_PAGE_ENTRIES - 1));
+		if(inPage > n - i) inPage = n - i;
+		int *page = sparsePeek(BANK_sparse, index);
+		if(page)
+		{
+			memcpy(&values[i], page, inPage * sizeof(int));
+			written = 1;
+		}
+		else
+		{
+			memset(&values[i], 0, inPage * sizeof(int));
+		}
+		i += inPage;
+	}
+	return written;
+}
+
+/*
+ *  Set a stored value without the storage delay
+ */
+void set_value( int ID, int value )
+{
+	*value_slot(ID) = value;
+}
+
+/*
+ *  Memory holding the stored values
+ */
+long stored_bytes()
+{
+	return BANK_sparse ? sparseBytes(BANK_sparse) : 0;
 }
 
 /*
@@ -54,5 +379,6 @@ void write_account( int ID, int value)
  */
  void free_accounts()
  {
- 	free(BANK_accounts);
+ 	//A shared segment stays mapped for whoever else uses it
+ 	if(!BANK_shared) free(BANK_accounts);
  }
\ No newline at end of file
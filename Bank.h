@@ -1,5 +1,3 @@
-/**  Do not modify this file  **/
-
 /*
  *  These functions do not provide any error checking.
  *  If an invalid input is supplied the behavior is
@@ -13,6 +11,45 @@
  */
 int initialize_accounts( int n );
 
+/*
+ *  Intialize n bank accounts with values of 0 in a shared memory segment, so another process
+ *  given its file descriptor can take them over with attach_accounts.
+ *  Input:  int n - Number of bank accounts, must be larger than 0
+ *  Return:  file descriptor of the segment, -1 if error
+ */
+int initialize_shared_accounts( int n );
+
+/*
+ *  Use n bank accounts made by initialize_shared_accounts, in this or another process, with their values.
+ *  Input:  int fd - File descriptor of the segment
+ *  Input:  int n - Number of bank accounts, the same as the segment was made with
+ *  Return:  1 if succeeded, 0 if error
+ */
+int attach_accounts( int fd, int n );
+
+/*
+ *  Intialize n sparse bank accounts, values take memory a page at a time as accounts are first written
+ *  and every account reads as 0 until then. Only one of the two initialize functions may be used.
+ *  Input:  int n - Number of bank accounts, must be larger than 0
+ *  Return:  1 if succeeded, 0 if error
+ */
+int initialize_sparse_accounts( int n );
+
+/*
+ *  Set how long each storage call takes, separately for reads and writes, NULL leaves a side as it is.
+ *  A model is one of
+ *    none                      no delay at all, not even a system call
+ *    fixed:US                  always US microseconds (the default is fixed:10000, or WAIT_TIME)
+ *    uniform:MIN:MAX           evenly spread between MIN and MAX microseconds
+ *    lognormal:MEDIAN:SIGMA    lognormal around MEDIAN microseconds, SIGMA is the spread of its log
+ *    histogram:FILE            drawn from a file of "microseconds count" lines
+ *  optionally followed by ,stall=P:US to make a call take US microseconds longer with chance P.
+ *  Input:  const char *reads - model for read_account and read_accounts
+ *  Input:  const char *writes - model for write_account and write_accounts
+ *  Return:  1 if succeeded, 0 if a model couldn't be parsed
+ */
+int set_latency( const char *reads, const char *writes );
+
 /*
  *  Read a bank account
  *  Input:  int ID - Id of bank account to read
@@ -20,6 +57,14 @@ int initialize_accounts( int n );
  */
 int read_account( int ID );
 
+/*
+ *  Read a batch of bank accounts with a single storage round trip
+ *  Input:  int *IDs - Ids of the bank accounts to read
+ *  Input:  int n - Number of Ids in the batch
+ *  Output:  int *values - values[i] receives the value of account IDs[i]
+ */
+void read_accounts( int *IDs, int n, int *values );
+
 /*
  *  Write value to bank account
  *  Input:  int ID - Id of bank account to write to
@@ -27,6 +72,42 @@ int read_account( int ID );
  */
 void write_account( int ID, int value);
 
+/*
+ *  Write a batch of bank accounts with a single storage round trip
+ *  Input:  int *IDs - Ids of the bank accounts to write to
+ *  Input:  int n - Number of Ids in the batch
+ *  Input:  int *values - values[i] is written to account IDs[i]
+ */
+void write_accounts( int *IDs, int n, int *values );
+
+/*
+ *  Direct access to the stored values, for placing or copying them without the storage delay
+ *  Return:  Pointer to the values of accounts 1 to n, account ID is at index ID - 1, NULL for sparse accounts
+ */
+int * account_storage();
+
+/*
+ *  Copy stored values without the storage delay, works for dense and sparse accounts
+ *  Input:  int first - Id of the first account to copy
+ *  Input:  int n - Number of accounts to copy
+ *  Output:  int *values - values[i] receives the value of account first + i
+ *  Return:  0 if none of the accounts was ever written (sparse accounts only), so they are all 0
+ */
+int copy_values( int first, int n, int *values );
+
+/*
+ *  Set a stored value without the storage delay
+ *  Input:  int ID - Id of bank account to write to
+ *  Input:  int value - value to write to account
+ */
+void set_value( int ID, int value );
+
+/*
+ *  Memory taken by sparse accounts' values so far
+ *  Return:  bytes allocated, 0 for dense accounts
+ */
+long stored_bytes();
+
 /*
  * Deallocate the memory for bank accounts
  */
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "affinity.h"
+
+int parseCpuList(const char *list, int *cpus, int max){
+	int count = 0;
+	const char *p = list;
+	while(*p && count < max){
+		char *end;
+		int first = strtol(p, &end, 10);
+		int last = first;
+		if(end == p){
+			break;
+		}
+		if(*end == '-'){
+			p = end+1;
+			last = strtol(p, &end, 10);
+		}
+		for(; first <= last && count < max; first++){
+			cpus[count] = first;
+			count++;
+		}
+		p = end;
+		while(*p == ',' || *p == ' ' || *p == '\n'){
+			p++;
+		}
+	}
+	return count;
+}
+
+int pinThread(pthread_t thread, int cpu){
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+//Read the cpus of a node from sysfs, returns how many there were
+int nodeCpus(int node, int *cpus, int max){
+	char path[128];
+	char list[4096];
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		return 0;
+	}
+	int len = fread(list, 1, sizeof(list)-1, f);
+	fclose(f);
+	list[len > 0 ? len : 0] = '\0';
+	return parseCpuList(list, cpus, max);
+}
+
+int numaNodeCount(){
+	int node;
+	char path[128];
+	for(node=0; node<MAX_NODES; node++){
+		sprintf(path, "/sys/devices/system/node/node%d", node);
+		if(access(path, F_OK) != 0){
+			break;
+		}
+	}
+	return node > 0 ? node : 1;
+}
+
+int cpuNode(int cpu){
+	int cpus[MAX_CPUS];
+	int nodes = numaNodeCount();
+	int node, i;
+	for(node=0; node<nodes; node++){
+		int count = nodeCpus(node, cpus, MAX_CPUS);
+		for(i=0; i<count; i++){
+			if(cpus[i] == cpu){
+				return node;
+			}
+		}
+	}
+	return 0;
+}
+
+int interleaveMemory(void *addr, size_t len, int *nodes, int count){
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long) addr + page-1) & ~(page-1);
+	unsigned long end = ((unsigned long) addr + len) & ~(page-1);
+	unsigned long nodeMask[MAX_NODES/(8*sizeof(unsigned long))+1] = {0};
+	int k;
+
+	//Only whole pages can be moved, the partial pages at the ends stay where they are
+	if(end <= start){
+		return 0;
+	}
+	for(k=0; k<count; k++){
+		nodeMask[nodes[k]/(8*sizeof(unsigned long))] |= 1UL << (nodes[k]%(8*sizeof(unsigned long)));
+	}
+	return syscall(SYS_mbind, start, end-start, MPOL_INTERLEAVE, nodeMask, MAX_NODES+1, MPOL_MF_MOVE);
+}
+
+void printTopology(FILE *out){
+	int cpus[MAX_CPUS];
+	int nodes = numaNodeCount();
+	int node, i;
+	fprintf(out, "topology: %d NUMA node%s, %ld online cpus\n", nodes, nodes == 1 ? "" : "s", sysconf(_SC_NPROCESSORS_ONLN));
+	for(node=0; node<nodes; node++){
+		int count = nodeCpus(node, cpus, MAX_CPUS);
+		fprintf(out, "  node %d cpus:", node);
+		for(i=0; i<count; i++){
+			fprintf(out, " %d", cpus[i]);
+		}
+		fprintf(out, "\n");
+	}
+}
@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <pthread.h>
+
+#define MAX_CPUS 1024
+#define MAX_NODES 64
+
+//Read a list of cpus like "0-3,8,10-11" into cpus, returns how many there were
+int parseCpuList(const char *list, int *cpus, int max);
+
+//Pin a thread to a single cpu, returns 0 if it worked
+int pinThread(pthread_t thread, int cpu);
+
+//The NUMA node a cpu belongs to, 0 when the machine doesn't report one
+int cpuNode(int cpu);
+
+//Number of NUMA nodes the machine reports, at least 1
+int numaNodeCount();
+
+//Spread the pages of a memory range round robin over some NUMA nodes and move them there, returns 0 if it worked
+int interleaveMemory(void *addr, size_t len, int *nodes, int count);
+
+//Print the NUMA nodes and the cpus that belong to each of them
+void printTopology(FILE *out);
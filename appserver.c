@@ -3,65 +3,384 @@
 #include <string.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <getopt.h>
 #include "appserver.h"
+#include "affinity.h"
+#include "bulkio.h"
+#include "cc.h"
+#include "coalesce.h"
+#include "ledger.h"
+#include "metrics.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "probes.h"
+#include "parse.h"
+#include "replica.h"
+#include "restart.h"
+#include "results.h"
+#include "snapshot.h"
+#include "storage.h"
+#include "timing.h"
+#include "trace.h"
 
-
-//Delete this later, this is for testing the queue
-void display(request *head);
-
-//Function to setup the queue
-void queueInit();
+unsigned long long monotonicNs();
 
 //This is the function that processes the users commands stored in the queue
 void * processCmd();
 
-queue *q;
-account *accounts;
-pthread_mutex_t queueMutex;
+//Split a CHECK over many accounts into chunks for the workers, and serve one of those chunks
+void startBulkCheck(request *req, int *ids, int count, int first);
+void processCheckChunk(request *req);
+
+//Pin the threads to cpus and spread the accounts over NUMA nodes, then report what was chosen
+void placeThreads(pthread_t *threads, int workerThreads, char *workerCpus, int ingestCpu, int writerCpu, int numa);
+
 FILE *output;
 
 int id = 1;
 int running =1;
+int numAccounts;
 int i;
 
+//The concurrency control strategy used when --cc isn't given
+#ifndef DEFAULT_CC
+#define DEFAULT_CC "2pl"
+#endif
+
+//Optional settings given after the required arguments
+struct option longOptions[] = {
+	{"ordered", optional_argument, NULL, 'o'},
+	{"max-queue", required_argument, NULL, 'q'},
+	{"when-full", required_argument, NULL, 'f'},
+	{"deadline", required_argument, NULL, 'd'},
+	{"trace", required_argument, NULL, 't'},
+	{"lock-profile", optional_argument, NULL, 'l'},
+	{"pin-workers", required_argument, NULL, 'W'},
+	{"pin-ingest", required_argument, NULL, 'I'},
+	{"pin-writer", required_argument, NULL, 'R'},
+	{"numa", no_argument, NULL, 'N'},
+	{"io-threads", required_argument, NULL, 'i'},
+	{"cc", required_argument, NULL, 'c'},
+	{"stripes", required_argument, NULL, 's'},
+	{"listen", required_argument, NULL, 'L'},
+	{"partition", required_argument, NULL, 'P'},
+	{"replicate", required_argument, NULL, 'r'},
+	{"replica-checks", no_argument, NULL, 'C'},
+	{"replica-of", required_argument, NULL, 'F'},
+	{"metrics", required_argument, NULL, 'M'},
+	{"output-format", required_argument, NULL, 'O'},
+	{"sparse", no_argument, NULL, 'S'},
+	{"pipeline", required_argument, NULL, 'p'},
+	{"stage-queue", required_argument, NULL, 'Q'},
+	{"latency", required_argument, NULL, 'y'},
+	{"read-latency", required_argument, NULL, 'Y'},
+	{"write-latency", required_argument, NULL, 'Z'},
+	{"ledger", no_argument, NULL, 'G'},
+	{"coalesce-checks", no_argument, NULL, 'K'},
+	{"handover", required_argument, NULL, 'H'},
+	{"takeover", required_argument, NULL, 'T'},
+	{NULL, 0, NULL, 0}
+};
+
 int main (int argc, char *argv[]){
+	int orderedWindow = 0;
+	int maxQueue = 0;
+	int blockWhenFull = 1;
+	int defaultDeadline = 0;
+	char *tracePath = NULL;
+	int lockStripes = 0;
+	char *workerCpus = NULL;
+	int ingestCpu = -1;
+	int writerCpu = -1;
+	int numa = 0;
+	int ioThreads = 0;
+	char *ccName = DEFAULT_CC;
+	char *listenPath = NULL;
+	int partitionBase = 0;
+	char *replicatePath = NULL;
+	int replicaChecks = 0;
+	char *replicaOf = NULL;
+	char *metricsPath = NULL;
+	int binaryOutput = 0;
+	int stageThreads[3] = {0, 0, 0};
+	int stageQueue = 64;
+	int sparse = 0;
+	int ledger = 0;
+	int coalesce = 0;
+	char *handoverPath = NULL;
+	char *takeoverPath = NULL;
+	FILE *trace = NULL;
+	int opt;
+
+	while((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1){
+		switch(opt){
+			case 'o':
+				orderedWindow = optarg ? atoi(optarg) : 1024;
+				break;
+			case 'q':
+				maxQueue = atoi(optarg);
+				break;
+			case 'f':
+				blockWhenFull = strcmp(optarg, "reject") != 0;
+				break;
+			case 'd':
+				defaultDeadline = atoi(optarg);
+				break;
+			case 't':
+				tracePath = optarg;
+				break;
+			case 'l':
+				lockStripes = optarg ? atoi(optarg) : 4096;
+				break;
+			case 'W':
+				workerCpus = optarg;
+				break;
+			case 'I':
+				ingestCpu = atoi(optarg);
+				break;
+			case 'R':
+				writerCpu = atoi(optarg);
+				break;
+			case 'N':
+				numa = 1;
+				break;
+			case 'i':
+				ioThreads = atoi(optarg);
+				break;
+			case 'c':
+				ccName = optarg;
+				break;
+			case 's':
+				ccStripes = atoi(optarg);
+				break;
+			case 'L':
+				listenPath = optarg;
+				break;
+			case 'P':
+				partitionBase = atoi(optarg);
+				break;
+			case 'r':
+				replicatePath = optarg;
+				break;
+			case 'C':
+				replicaChecks = 1;
+				break;
+			case 'F':
+				replicaOf = optarg;
+				break;
+			case 'M':
+				metricsPath = optarg;
+				break;
+			case 'O':
+				binaryOutput = strcmp(optarg, "binary") == 0;
+				if(!binaryOutput && strcmp(optarg, "text") != 0){
+					argc = 0;
+				}
+				break;
+			case 'S':
+				sparse = 1;
+				break;
+			case 'G':
+				ledger = 1;
+				break;
+			case 'K':
+				coalesce = 1;
+				break;
+			case 'H':
+				handoverPath = optarg;
+				break;
+			case 'T':
+				takeoverPath = optarg;
+				break;
+			case 'p':
+				if(sscanf(optarg, "%d,%d,%d", &stageThreads[0], &stageThreads[1], &stageThreads[2]) != 3 || stageThreads[0] < 1 || stageThreads[1] < 1 || stageThreads[2] < 1){
+					argc = 0;
+				}
+				break;
+			case 'Q':
+				stageQueue = atoi(optarg);
+				break;
+			case 'y':
+				if(!set_latency(optarg, optarg)){
+					argc = 0;
+				}
+				break;
+			case 'Y':
+				if(!set_latency(optarg, NULL)){
+					argc = 0;
+				}
+				break;
+			case 'Z':
+				if(!set_latency(NULL, optarg)){
+					argc = 0;
+				}
+				break;
+			default:
+				argc = 0;
+		}
+	}
 
 	//Check for valid arguments to the program
-	if(argc != 4){
+	//The pipeline releases accounts on another thread than the one that locked them, only ticket locks allow that
+	if(stageThreads[0] > 0){
+		ccName = "fifo";
+	}
+	cc = ccFind(ccName);
+	if(argc - optind != 3 || cc == NULL || ccStripes < 1 || stageQueue < 1 || (sparse && numa)
+		|| ((handoverPath || takeoverPath) && (sparse || listenPath || replicatePath || replicaOf || ledger))){
 		printf("Launch the server with the following syntax\n");
-		printf("./appserver <# of worker thread> <# of accounts> <output file>\n");
+		printf("./appserver <# of worker thread> <# of accounts> <output file> [options]\n");
+		printf("  --ordered[=WINDOW]  write results in request ID order, holding back at most WINDOW requests (default 1024)\n");
+		printf("  --max-queue=N       queue at most N requests (default unbounded)\n");
+		printf("  --when-full=MODE    when the queue is full, block the input or reject the request with BUSY (default block)\n");
+		printf("  --deadline=MS       drop requests that wait in the queue longer than MS milliseconds (default never)\n");
+		printf("  --trace=FILE        record every input line and its arrival time to FILE for ./replay\n");
+		printf("  --lock-profile[=N]  count lock waits and hold times for each account, or for N stripes of accounts (default 4096)\n");
+		printf("  --pin-workers=CPUS  pin the workers round robin to a cpu list like 0-3,8\n");
+		printf("  --pin-ingest=CPU    pin the thread reading requests to a cpu\n");
+		printf("  --pin-writer=CPU    pin the ordered output writer to a cpu\n");
+		printf("  --numa              interleave the accounts over the NUMA nodes the workers run on\n");
+		printf("  --io-threads=N      issue the storage calls of a transaction concurrently from N I/O threads\n");
+		printf("  --cc=STRATEGY       concurrency control, one of ");
+		ccList(stdout);
+		printf(" (default %s)\n", DEFAULT_CC);
+		printf("  --stripes=N         number of locks for --cc=striped (default 256)\n");
+		printf("  --listen=PATH       run as a partition for ./router, taking requests on a Unix socket instead of stdin\n");
+		printf("  --partition=BASE    with --listen, the accounts are BASE+1 to BASE+<# of accounts>\n");
+		printf("  --replicate=PATH    stream committed balances to read replicas connecting on a Unix socket\n");
+		printf("  --replica-checks    with --replicate, send single account CHECKs to the replicas\n");
+		printf("  --replica-of=PATH   run as a read replica of the primary at PATH, answering its CHECKs instead of reading stdin\n");
+		printf("  --metrics=PATH      account worker time and serve live metrics as Prometheus text on a Unix socket\n");
+		printf("  --sparse            allocate balances and locks a page of accounts at a time as they are first used, not with --numa\n");
+		printf("  --pipeline=C,S,O    workers only parse, CHECK and TRANS go on through cc, storage and output stages\n");
+		printf("                      with C, S and O threads and bounded queues between them, always uses --cc=fifo\n");
+		printf("  --stage-queue=N     requests each pipeline stage's queue holds (default 64)\n");
+		printf("  --latency=MODEL     how long each storage call takes: none, fixed:US, uniform:MIN:MAX, lognormal:MEDIAN:SIGMA\n");
+		printf("                      or histogram:FILE of \"microseconds count\" lines, with an optional ,stall=P:US (default fixed:10000)\n");
+		printf("  --read-latency=MODEL, --write-latency=MODEL  the same for only reads or only writes\n");
+		printf("  --coalesce-checks   a CHECK of an account another CHECK is reading shares that read\n");
+		printf("  --ledger            keep every account's committed TRANS changes for HISTORY <acct> [limit]\n");
+		printf("  --handover=PATH     keep the balances in shared memory and hand the server over to a replacement\n");
+		printf("                      started with --takeover=PATH, not with --sparse, --listen, replication or --ledger\n");
+		printf("  --takeover=PATH     take over the input, output, balances and queue of the server at PATH, whose\n");
+		printf("                      accounts and output format are used, and be replaceable at PATH in turn\n");
+		printf("  --output-format=F   text, or binary for a compact result log that ./resultconv turns back into text (default text)\n");
 		exit(1);
 	}
+	argv += optind-1;
 
 	//Setup the queue
-	q = (queue*) malloc(sizeof(queue));
-	queueInit();
-	pthread_mutex_init(&queueMutex, NULL);
+	queueInit(maxQueue);
 	
 	//Set the number of treads and accounts according to the arguments
 	int workerThreads = atoi(argv[1]);
-	int numAccounts = atoi(argv[2]);
+	numAccounts = atoi(argv[2]);
 	char outName[strlen(argv[3]+1)];
 	strcpy(outName, argv[3]);
 	outName[strlen(argv[3])] = '\0';
 
-	output= fopen(outName, "w");
-	
-	//Allocate memory for the accounts
-	accounts = (account*) malloc(numAccounts*sizeof(account));
+	//A replica's results go back to the primary, as text lines
+	if(replicaOf){
+		output = replicaConnect(replicaOf);
+		binaryOutput = 0;
+	}
+	//A replacement carries on with the old server's output file and request IDs
+	else if(takeoverPath){
+		id = takeover(takeoverPath, &numAccounts, &output, &binaryOutput);
+	} else {
+		output= fopen(outName, "w");
+	}
+	resultsInit(output, orderedWindow, binaryOutput);
 
-	//Setup the accounts
-	initialize_accounts(numAccounts);
-	for(i=0; i<numAccounts; i++){
-		pthread_mutex_init(&(accounts[i].lock), NULL);
-		accounts[i].value = 0;
+	if(tracePath){
+		trace = traceStart(tracePath);
+		if(trace == NULL){
+			printf("Could not create the trace file %s\n", tracePath);
+			exit(1);
+		}
+	}
+	
+	//Setup the accounts and their locks
+	unsigned long long setupStart = monotonicNs();
+	if(takeoverPath){
+		//The balances were mapped by the takeover
+	} else if(sparse){
+		initialize_sparse_accounts(numAccounts);
+	} else if(handoverPath){
+		int shared = initialize_shared_accounts(numAccounts);
+		if(shared < 0){
+			printf("Could not put the accounts in shared memory\n");
+			exit(1);
+		}
+		handoverListen(handoverPath, shared, numAccounts);
+	} else {
+		initialize_accounts(numAccounts);
+	}
+	initAccounts(numAccounts, sparse);
+	snapshotInit(numAccounts);
+	cc->init(numAccounts);
+	if(ledger){
+		ledgerInit(numAccounts);
+	}
+	if(coalesce){
+		coalesceInit();
+	}
+	//The serial baseline runs everything on one thread
+	if(strcmp(cc->name, "serial") == 0){
+		workerThreads = 1;
+		ioThreads = 0;
+	}
+	fprintf(stderr, "accounts: %d %s, set up in %.1f ms\n", numAccounts, sparse ? "sparse" : "dense", (monotonicNs()-setupStart)/1e6);
+	if(lockStripes > 0){
+		lockProfileInit(lockStripes, numAccounts);
 	}
 	
+	bulkIoInit(workerThreads, numAccounts);
+	if(metricsPath){
+		metricsListen(metricsPath);
+	}
+
+	//Start the storage I/O threads before the workers that use them
+	storageInit(ioThreads);
+
+	//A partition serves its router's connections instead of reading requests, and never returns
+	if(listenPath){
+		servePartition(listenPath, partitionBase, numAccounts);
+	}
+
+	if(stageThreads[0] > 0){
+		pipelineInit(stageThreads[0], stageThreads[1], stageThreads[2], stageQueue);
+	}
+
+	if(replicatePath){
+		replicationListen(replicatePath, numAccounts, replicaChecks);
+	}
+
 	//Initialize all of the worker threads, they will be executing the requests in processCmd
 	pthread_t threads[workerThreads];
 	for(i=0; i<workerThreads; i++){
 		pthread_create(&threads[i], NULL, processCmd, NULL);
 	}
+	if(workerCpus || ingestCpu >= 0 || writerCpu >= 0 || numa){
+		placeThreads(threads, workerThreads, workerCpus, ingestCpu, writerCpu, numa);
+	}
+
+	//A replica takes its requests from the primary's stream until the primary ends it
+	if(replicaOf){
+		replicaFollow(numAccounts);
+		pthread_mutex_lock(&queueMutex);
+		running = 0;
+		pthread_cond_broadcast(&queueNotEmpty);
+		pthread_mutex_unlock(&queueMutex);
+	}
+
+	//After a takeover the old server waits until this one is ready before it exits
+	takeoverDone();
+
+	//Lines have no length limit, the buffer grows to the longest one
+	char *line = NULL;
+	size_t lineSize = 0;
 
 	//Main server loop that does everthing
 	while(running){
@@ -69,18 +388,66 @@ int main (int argc, char *argv[]){
 		printf("> ");
 		
 		//Get the user input
-		char request[1024];
-    		fgets(request, 1024, stdin);
-		request[strlen(request)-1] = '\0';
+		//The end of the input ends the server the same way END does
+		//A replacement that connected gets the rest of it
+		int got = readRequest(&line, &lineSize);
+		char *request = line;
+		if(got < 0){
+			handover(id, output, binaryOutput);
+		}
+    		if(got == 0){
+			request = "END";
+		}
+		if(trace){
+			traceLine(trace, request);
+		}
+		
+		//LOCKSTATS [n] prints the n most waited on accounts right away, it is not a queued request
+		if(strncmp(request, "LOCKSTATS", 9) == 0 && (request[9] == '\0' || request[9] == ' ')){
+			lockProfileReport(stdout, request[9] ? atoi(request+10) : 10);
+			continue;
+		}
 		
 		if((strcmp(request, "END")) == 0){
+			//Wake up the idle workers so they see the server is ending
+			pthread_mutex_lock(&queueMutex);
 			running = 0;
+			pthread_cond_broadcast(&queueNotEmpty);
+			pthread_mutex_unlock(&queueMutex);
 			break;
 		}
+
+		//A request may carry its own deadline as DEADLINE <ms> <request>
+		char *cmd = request;
+		int deadlineMs = defaultDeadline;
+		if(strncmp(request, "DEADLINE ", 9) == 0){
+			deadlineMs = strtol(request+9, &cmd, 10);
+			while(*cmd == ' '){
+				cmd++;
+			}
+		}
+		struct timeval deadline = {0, 0};
+		if(deadlineMs > 0){
+			gettimeofday(&deadline, NULL);
+			deadline.tv_sec += deadlineMs/1000;
+			deadline.tv_usec += (deadlineMs%1000)*1000;
+			if(deadline.tv_usec >= 1000000){
+				deadline.tv_sec++;
+				deadline.tv_usec -= 1000000;
+			}
+		}
 		
 		//Push to the queue and increment the id number
 		pthread_mutex_lock(&queueMutex);
-		push(request, id);
+		//When the queue is full the request either waits here for room or is turned away
+		if(!queueAdmit(blockWhenFull)){
+			pthread_mutex_unlock(&queueMutex);
+			printf("< BUSY\n");
+			continue;
+		}
+		push(cmd, id, deadline);
+		BANK_PROBE2(enqueue, id, cmd);
+		pthread_cond_signal(&queueNotEmpty);
 		//Give the user the immediate feedback
 		printf("< ID %d\n", id);
 		pthread_mutex_unlock(&queueMutex);
@@ -92,6 +459,34 @@ int main (int argc, char *argv[]){
 		pthread_join(threads[i], NULL);
 	}
 	
+	//Requests the workers handed on may still be in the stages, routed checks are still owed
+	//by the replicas, and snapshots may still be writing
+	pipelineClose();
+	replicationClose();
+	snapshotClose();
+
+	//Write any results still held back for ordering
+	resultsClose(id-1);
+	queueStats();
+	timingReport(stderr);
+	if(replicaOf){
+		replicaStats(stderr);
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(stderr, "memory: peak RSS %.1f MB\n", usage.ru_maxrss/1024.0);
+	if(sparse){
+		fprintf(stderr, "sparse accounts: %.1f MB of balances and %.1f MB of account locks allocated\n", stored_bytes()/1048576.0, accountBytes()/1048576.0);
+	}
+	ledgerStats(stderr);
+	coalesceStats(stderr);
+	if(lockStripes > 0){
+		lockProfileReport(stderr, 10);
+	}
+	if(trace){
+		fclose(trace);
+	}
+
 	//Clean up and return
 	free(accounts);
 	free(q);
@@ -100,204 +495,235 @@ int main (int argc, char *argv[]){
 
 }
 
-//Initialize the queue with NULL values and 0 items
-void queueInit(){
-	q->front = NULL;
-	q->rear = NULL;
-	q->count =0;
-}
-
-//This is a function to display the contents of the queue, used for testing early in the project
-void display(request *head){
-	if(head == NULL){
-		printf("NULL\n");
-	} else {
-		printf("%s\n", head->command);
-		display(head->next);
-	}
-}
-
-//Add new requests to the end of the queue
-void push(char *cmd, int requestId){
-	request *toAdd = malloc(sizeof(request));
-	
-	toAdd->command = malloc(1024*sizeof(char));
-	strncpy(toAdd->command, cmd, 1024);
-	toAdd->requestId = requestId;
-	gettimeofday(&(toAdd->timeStart),NULL);
-	toAdd->next = NULL;
-
-	if(q->count > 0){
-		q->rear->next = toAdd;
-		q->rear = toAdd;
-		q->count = q->count+1;
-	} else {
-		q->front = toAdd;
-		q->rear = toAdd;
-		q->count = 1;
-	}
-}
-
-//Remove requests from the front of the queue and slide all the other requests forward
-request pop(){
-	request *temp;
-	request toPop;
-
-	if(q->count >0){
-		toPop.requestId = q->front->requestId;
-		toPop.command = malloc(1024 * sizeof(char));
-		toPop.timeStart = q->front->timeStart;
-		strncpy(toPop.command, q->front->command, 1024);
-		toPop.next = NULL;
-
-		temp = q->front;
-		q->front = q->front->next;
-		free(temp->command);
-		free(temp);
-		
-		if(!q->front){
-			q->rear = NULL;
-		}
-
-		q->count = q->count -1;
-	} else {
-		toPop.command = NULL;
-	}
-
-	return toPop;
-}
-
 //Function each of the worker threads continuously runs
 void * processCmd(){
+	timingWorker();
+	snapshotWorker();
 	//We want the thread to run while therer are objects in the queue or there hasnt been an END request
 	while(running || q->front != NULL){
 		//Lock the queue to try to pop from it
+		timingSet(STATE_IDLE);
+		snapshotRequest(0);
 		pthread_mutex_lock(&queueMutex);
+		//Sleep until there is a request to take or the server is ending
+		while(running && q->front == NULL){
+			pthread_cond_wait(&queueNotEmpty, &queueMutex);
+		}
 		//If the head of the queue is a request process it
 		if(q->front != NULL){
 			request req;
 			req = pop();
+			//Snapshots look at the queue and the workers' requests together, so the request is never in neither
+			snapshotRequest(req.requestId);
 			pthread_mutex_unlock(&queueMutex);
+			timingSet(STATE_OTHER);
+
+			//Chunks of a bulk check have no command string to parse
+			if(req.bulk){
+				processCheckChunk(&req);
+				continue;
+			}
+			if(req.job){
+				processBulkJob(req.job, req.requestId, req.timeStart);
+				continue;
+			}
+			BANK_PROBE1(dequeue, req.requestId);
+
+			//Requests that waited in the queue past their deadline are dropped with a timeout
+			if(req.deadline.tv_sec){
+				struct timeval now;
+				gettimeofday(&now, NULL);
+				if(timercmp(&now, &req.deadline, >)){
+					char result[128];
+					int len = resultEncode(result, req.requestId, RESULT_TIMEOUT, 0, 0, req.timeStart, now);
+					resultWrite(req.requestId, result, len, 1);
+					__sync_fetch_and_add(&expiredRequests, 1);
+					free(req.command);
+					continue;
+				}
+			}
 
 			/*Process the request string and convert it to a request array
 			This code came from my project 1 user input processing
 			*/
-			int arrayLen = strlen(req.command);
-			char charArray[arrayLen+1];
-			strcpy(charArray, req.command);
-			charArray[arrayLen = '\0'];
-			int length = strlen(charArray);
 			int j;
-    			int spaces =0;
-    			for(j =0; j<length; j++){
-      				if(charArray[j] == ' '){
-        				spaces++;
-      				}
-    			}
-
-    			//Initialize the argument array to have space for a null at the end
-    			char* command[(spaces+2)];
-    			//Initialize the entire array to be null to start
-    			for(j =0; j<spaces+2; j++){
-      				command[j] = NULL;
-    			}
-
-    			int i = 0;
-
-    			//Cut the string string up into individual array indexes
-    			char * cut = strtok(charArray, " ");
-    			while(cut != NULL){
-        			command[i] = cut;
-        			cut = strtok(NULL, " ");
-        			i++;
-    			}
+			timingSet(STATE_PARSE);
+			int spaces = countSpaces(req.command);
+			//Initialize the argument array to have space for a null at the end
+			//It is the worker's own room on the heap, a TRANS may have thousands of pairs
+			char **command = commandRoom(spaces+2);
+			int parts = splitCommand(req.command, command, spaces);
+			timingSet(STATE_OTHER);
 
 			//End of request processing, now we actually start to process the request
 
+			//Blank lines have nothing to process
+			if(command[0] == NULL){
+				timingRequest(REQ_OTHER);
+				resultWrite(req.requestId, NULL, 0, 1);
+			}
+			//CHECKALL reads every account in bulk
+			else if(strcmp(command[0], "CHECKALL") == 0){
+				timingRequest(REQ_BULK_CHECK);
+				startBulkCheck(&req, NULL, numAccounts, 1);
+			}
+			//CHECK with a range or with several accounts is also read in bulk
+			else if(strcmp(command[0], "CHECK") == 0 && (parts > 2 || (parts == 2 && strchr(command[1]+1, '-')))){
+				int first, last;
+				timingRequest(REQ_BULK_CHECK);
+				if(parts == 2 && sscanf(command[1], "%d-%d", &first, &last) == 2){
+					//Clamp the range to the accounts that exist
+					if(first < 1){
+						first = 1;
+					}
+					if(last > numAccounts){
+						last = numAccounts;
+					}
+					startBulkCheck(&req, NULL, last >= first ? last-first+1 : 0, first);
+				} else {
+					int *ids = malloc((parts-1)*sizeof(int));
+					int count = 0;
+					for(j=1; j<parts; j++){
+						int accountNum = atoi(command[j]);
+						if(accountNum >= 1 && accountNum <= numAccounts){
+							ids[count] = accountNum;
+							count++;
+						}
+					}
+					startBulkCheck(&req, ids, count, 0);
+				}
+			}
+			//If the request is a check request
+			//LOAD and DUMP move balances in bulk between the accounts and a file
+			else if(strcmp(command[0], "LOAD") == 0 && parts == 2){
+				timingRequest(REQ_LOAD);
+				startLoad(req.requestId, req.timeStart, command[1]);
+			}
+			else if(strcmp(command[0], "DUMP") == 0 && (parts == 2 || parts == 3)){
+				timingRequest(REQ_DUMP);
+				startDump(req.requestId, req.timeStart, command[1], command[2]);
+			}
+			//SNAPSHOT writes every balance at one point in time from a forked copy of the server
+			else if(strcmp(command[0], "SNAPSHOT") == 0 && parts == 2){
+				timingRequest(REQ_OTHER);
+				startSnapshot(req.requestId, req.timeStart, command[1]);
+			}
+			//HISTORY lists an account's newest ledger entries
+			else if(strcmp(command[0], "HISTORY") == 0 && (parts == 2 || parts == 3)){
+				timingRequest(REQ_OTHER);
+				ledgerHistory(req.requestId, req.timeStart, atoi(command[1]), parts == 3 ? atoi(command[2]) : 10);
+			}
 			//If the request is a check request
-			if(strcmp(command[0], "CHECK") == 0){
+			else if(strcmp(command[0], "CHECK") == 0){
 				int balance;
-				account acc;
 				int accountNum = atoi(command[1]);
-				acc = accounts[accountNum-1];
-				//Lock the account to read the balance
-				pthread_mutex_lock(&acc.lock);
-				balance = read_account(accountNum);
-				//Unlock the account because we are done reading it
-				pthread_mutex_unlock(&acc.lock);
+				unsigned version;
+				timingRequest(REQ_CHECK);
+				//A read replica may answer it instead, the answer comes back on the replica's own thread
+				//or it may share the read of another CHECK of the same account
+				if(routeCheck(req.requestId, req.timeStart, accountNum) || pipelineCheck(req.requestId, req.timeStart, accountNum) || coalesceCheck(req.requestId, req.timeStart, accountNum)){
+					free(req.command);
+					continue;
+				}
+				//Read the balance under the concurrency control strategy, starting over if it was changed meanwhile
+				do{
+					BANK_PROBE4(lock_start, req.requestId, REQ_CHECK, 1, &accountNum);
+					cc->begin(&accountNum, 1, &version);
+					BANK_PROBE4(lock_end, req.requestId, REQ_CHECK, 1, &accountNum);
+					BANK_PROBE4(read, req.requestId, REQ_CHECK, 1, &accountNum);
+					storageReadAll(&accountNum, 1, &balance);
+				} while(!cc->validate(&accountNum, 1, &version));
+				//Done with the account
+				cc->end(&accountNum, 1, 0);
 				struct timeval finished;
 				gettimeofday(&finished, NULL);
-				//Lock and write to the file, then unlock it to allow other threads to write to it
-				flockfile(output);
-				fprintf(output, "%d BAL %d TIME %d.%06d %d.%06d\n", req.requestId, balance, req.timeStart.tv_sec, req.timeStart.tv_usec, finished.tv_sec, finished.tv_usec);
-				funlockfile(output);
+				//Hand the result to the writer
+				char result[128];
+				int len = resultEncode(result, req.requestId, RESULT_BAL, balance, 0, req.timeStart, finished);
+				resultWrite(req.requestId, result, len, 1);
 			}
 			//If the request is a transaction request
 			else if((strcmp(command[0], "TRANS")) == 0){
-				int numOfTrans = spaces/2;
-				int accountNums[numOfTrans];
-				int amounts[numOfTrans];
-				int ISF=0;
-				
+				//The pairs are parsed into the worker's room as well
+				int maxPairs = spaces/2+1;
+				int *accountNums = pairsRoom(maxPairs, 5);
+				int *lockOrder = accountNums+maxPairs;
+				int numLocks;
+				int *amounts = lockOrder+maxPairs;
+				int *balances = amounts+maxPairs;
+				unsigned *versions = (unsigned*) (balances+maxPairs);
+				int ISF;
+				char result[128];
+				int len;
 				int i;
-				int accIndex =0;
-				int amIndex =0;
+				
+				timingRequest(REQ_TRANS);
 				//Loop through the command array, starting at 1
-				//Odd indexes should be the account num, and even should be the ammounts
-				for(i=1; i<spaces+1; i++){
-					if(i%2 == 0){
-						amounts[amIndex] = atoi(command[i]);
-						amIndex++;
-					}
-					else{
-						accountNums[accIndex] = atoi(command[i]);
-						accIndex++;
-					}
-				}
-				//Get and lock the associated accounts
-				for(i=0; i<numOfTrans; i++){
-					account acc;
-					acc = accounts[accountNums[i]-1];
-					pthread_mutex_lock(&acc.lock);
+				timingSet(STATE_PARSE);
+				int numOfTrans = parseTrans(command, parts, accountNums, amounts);
+				//In the pipeline the stages take it from here
+				if(pipelineTrans(req.requestId, req.timeStart, accountNums, amounts, numOfTrans)){
+					free(req.command);
+					continue;
 				}
-				//Check to see if each account has enough money, if one of them doesnt break out of processing the command
-				for(i=0; i<numOfTrans; i++){
-					int accBalance = read_account(accountNums[i]);
-					if((accBalance + amounts[i]) < 0){
-						ISF=1;
-						break;
+				//Get the associated accounts in increasing order, the order every strategy locks them in so two transactions can't deadlock
+				memcpy(lockOrder, accountNums, numOfTrans*sizeof(int));
+				numLocks = sortAccounts(lockOrder, numOfTrans);
+				timingSet(STATE_OTHER);
+				do{
+					BANK_PROBE4(lock_start, req.requestId, REQ_TRANS, numLocks, lockOrder);
+					cc->begin(lockOrder, numLocks, versions);
+					BANK_PROBE4(lock_end, req.requestId, REQ_TRANS, numLocks, lockOrder);
+					//Read every account at once, the ISF decision is made when all of the reads are back
+					BANK_PROBE4(read, req.requestId, REQ_TRANS, numLocks, lockOrder);
+					storageReadAll(lockOrder, numLocks, balances);
+					//Check to see if each account has enough money, if one of them doesnt break out of processing the command
+					ISF = 0;
+					for(i=0; i<numOfTrans; i++){
+						int k = accountIndex(lockOrder, numLocks, accountNums[i]);
+						if((balances[k] + amounts[i]) < 0){
+							ISF=1;
+							break;
+						}
+						balances[k] += amounts[i];
 					}
-				}
-				//If one of the accounts didnt have enough money, lock the output file and write to it
+				//Start over if the strategy finds the accounts changed since they were read
+				} while(!cc->validate(lockOrder, numLocks, versions));
+				BANK_PROBE4(isf, req.requestId, numOfTrans, ISF, ISF ? accountNums[i] : 0);
+				//If one of the accounts didnt have enough money, the result names that account
 				if(ISF){
 					struct timeval finished;
 					gettimeofday(&finished, NULL);
-					flockfile(output);
-					fprintf(output, "%d ISF %d TIME %d.%06d %d.%06d\n", req.requestId, accountNums[i], req.timeStart.tv_sec, req.timeStart.tv_usec, finished.tv_sec, finished.tv_usec);
-					funlockfile(output);
+					len = resultEncode(result, req.requestId, RESULT_ISF, accountNums[i], 0, req.timeStart, finished);
 				}
-				//Otherwise each account had enough money so go through and process each transaction
+				//Otherwise each account had enough money so write all the new balances at once
 				else{
-					for(i=0; i< numOfTrans; i++){
-						account acc = accounts[accountNums[i]-1];
-						int accBalance = read_account(accountNums[i]);
-						write_account(accountNums[i], (accBalance+amounts[i]));
-					}
+					//A snapshot can't be taken while the balances are being written
+					//It is held off only once the accounts are, so a snapshot never waits on a lock wait
+					snapshotWriteBegin();
+					BANK_PROBE3(write, req.requestId, numLocks, lockOrder);
+					storageWriteAll(lockOrder, numLocks, balances);
+					//The replicas get the new balances while the accounts are still held, so they see commits in order
+					replicateCommit(lockOrder, numLocks, balances);
+					ledgerCommit(req.requestId, lockOrder, balances, numLocks, accountNums, amounts, numOfTrans);
+					snapshotWriteEnd();
 					struct timeval finished;
 					gettimeofday(&finished, NULL);
-					//Lock the output file and write to it, then unlock it for the other threads to access
-					flockfile(output);
-					fprintf(output, "%d OK TIME %d.%06d %d.%06d\n", req.requestId, req.timeStart.tv_sec, req.timeStart.tv_usec, finished.tv_sec, finished.tv_usec);
-					funlockfile(output);
+					len = resultEncode(result, req.requestId, RESULT_OK, 0, 0, req.timeStart, finished);
 				}
 				
-				//Go back through each account and unlock them so they can be accessed by other threads
-				for(i=0; i<numOfTrans; i++){
-					account acc;
-					acc = accounts[accountNums[i]-1];
-					pthread_mutex_unlock(&acc.lock);
-				}
+				//Go back through each account and release them so they can be accessed by other threads
+				cc->end(lockOrder, numLocks, !ISF);
+				timingTrans(ISF);
+				//The result is handed over only after unlocking, the writer may make us wait for earlier requests
+				resultWrite(req.requestId, result, len, 1);
+			}
+			//Anything else is not a request we know, but it still used up an ID
+			else{
+				timingRequest(REQ_OTHER);
+				resultWrite(req.requestId, NULL, 0, 1);
 			}
+			free(req.command);
 		} else {
 			//Uulock the queue for others to use
 			pthread_mutex_unlock(&queueMutex);
@@ -305,3 +731,143 @@ void * processCmd(){
 
 	}
 }
+
+//Set up a bulk check over either the accounts in ids or the range starting at first, and queue its chunks
+//The bulk check takes ownership of ids
+void startBulkCheck(request *req, int *ids, int count, int first){
+	if(ids){
+		count = sortAccounts(ids, count);
+	}
+
+	//Nothing to read, so answer with an empty block right away
+	if(count == 0){
+		struct timeval finished;
+		gettimeofday(&finished, NULL);
+		char result[128];
+		int len = resultEncode(result, req->requestId, RESULT_BALS, 0, 0, req->timeStart, finished);
+		resultWrite(req->requestId, result, len, 1);
+		free(ids);
+		return;
+	}
+
+	bulkCheck *bulk = malloc(sizeof(bulkCheck));
+	bulk->ids = ids;
+	bulk->first = first;
+	bulk->count = count;
+	bulk->chunksLeft = (count+BULK_CHUNK-1)/BULK_CHUNK;
+
+	pthread_mutex_lock(&queueMutex);
+	pushChunks(bulk, req->requestId, req->timeStart);
+	pthread_cond_broadcast(&queueNotEmpty);
+	pthread_mutex_unlock(&queueMutex);
+}
+
+//Read one chunk of a bulk check with a single storage call and write its balances as one block
+void processCheckChunk(request *req){
+	bulkCheck *bulk = req->bulk;
+	int ids[BULK_CHUNK];
+	int values[BULK_CHUNK];
+	int j;
+
+	for(j=0; j<req->chunkLen; j++){
+		if(bulk->ids){
+			ids[j] = bulk->ids[req->chunkStart+j];
+		} else {
+			ids[j] = bulk->first+req->chunkStart+j;
+		}
+	}
+
+	//The ids are in increasing order, which is the same order transactions lock in
+	unsigned versions[BULK_CHUNK];
+	do{
+		cc->begin(ids, req->chunkLen, versions);
+		storageReadBatch(ids, req->chunkLen, values);
+	} while(!cc->validate(ids, req->chunkLen, versions));
+	cc->end(ids, req->chunkLen, 0);
+
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+
+	//Format the whole block first so it is written with a single call
+	char *block = malloc(128 + req->chunkLen*32);
+	int len = resultEncode(block, req->requestId, RESULT_BALS, req->chunkLen, 0, req->timeStart, finished);
+	for(j=0; j<req->chunkLen; j++){
+		len += resultEncode(block+len, req->requestId, RESULT_ACCOUNT, values[j], ids[j], req->timeStart, finished);
+	}
+	//The last chunk to finish completes the request and cleans up the bulk check
+	int last = __sync_sub_and_fetch(&bulk->chunksLeft, 1) == 0;
+	resultWrite(req->requestId, block, len, last);
+	free(block);
+	if(last){
+		free(bulk->ids);
+		free(bulk);
+	}
+}
+
+void placeThreads(pthread_t *threads, int workerThreads, char *workerCpus, int ingestCpu, int writerCpu, int numa){
+	int cpus[MAX_CPUS];
+	int nodes[MAX_NODES];
+	int numCpus = 0;
+	int numNodes = 0;
+	int j, k;
+
+	printTopology(stderr);
+
+	//Workers go round robin over the cpu list
+	if(workerCpus){
+		numCpus = parseCpuList(workerCpus, cpus, MAX_CPUS);
+	}
+	for(j=0; j<workerThreads && numCpus > 0; j++){
+		int cpu = cpus[j % numCpus];
+		int node = cpuNode(cpu);
+		if(pinThread(threads[j], cpu) != 0){
+			fprintf(stderr, "  worker %d could not be pinned to cpu %d\n", j, cpu);
+			continue;
+		}
+		fprintf(stderr, "  worker %d on cpu %d (node %d)\n", j, cpu, node);
+		for(k=0; k<numNodes && nodes[k] != node; k++);
+		if(k == numNodes){
+			nodes[numNodes] = node;
+			numNodes++;
+		}
+	}
+
+	//The ingest thread allocates every queued request, so pinning it also decides where the queue memory lives
+	if(ingestCpu >= 0){
+		if(pinThread(pthread_self(), ingestCpu) == 0){
+			fprintf(stderr, "  ingest on cpu %d (node %d), queued requests are allocated there\n", ingestCpu, cpuNode(ingestCpu));
+		} else {
+			fprintf(stderr, "  ingest could not be pinned to cpu %d\n", ingestCpu);
+		}
+	}
+
+	pthread_t writer;
+	if(writerCpu >= 0){
+		if(!resultsWriter(&writer)){
+			fprintf(stderr, "  no writer thread to pin, results are written by the workers (use --ordered)\n");
+		} else if(pinThread(writer, writerCpu) == 0){
+			fprintf(stderr, "  writer on cpu %d (node %d)\n", writerCpu, cpuNode(writerCpu));
+		} else {
+			fprintf(stderr, "  writer could not be pinned to cpu %d\n", writerCpu);
+		}
+	}
+
+	//Any worker takes any request from the one queue, so no account is local to a worker
+	//Interleaving the accounts over the nodes the workers run on (every node if they aren't pinned) spreads their memory traffic instead
+	if(numa){
+		if(numNodes == 0){
+			numNodes = numaNodeCount();
+			for(k=0; k<numNodes; k++){
+				nodes[k] = k;
+			}
+		}
+		int *storage = account_storage();
+		int locksMoved = interleaveMemory(accounts, numAccounts*sizeof(account), nodes, numNodes) == 0;
+		int storageMoved = interleaveMemory(storage, numAccounts*sizeof(int), nodes, numNodes) == 0;
+		fprintf(stderr, "  accounts 1-%d interleaved page by page over node%s", numAccounts, numNodes == 1 ? "" : "s");
+		for(k=0; k<numNodes; k++){
+			fprintf(stderr, "%s%d", k ? "," : " ", nodes[k]);
+		}
+		fprintf(stderr, "%s\n", locksMoved && storageMoved ? "" : " (could not be moved)");
+	}
+}
@@ -1,14 +1,46 @@
 #include "Bank.h"
 
+//Number of accounts each worker reads in one batched storage call for bulk checks
+#define BULK_CHUNK 256
+
 typedef struct account{
 	pthread_mutex_t lock;
 	int value;
+	//When the current holder got the lock, only kept while lock profiling
+	unsigned long long lockedAt;
+	//Changed every time the account is written, for optimistic concurrency control
+	unsigned version;
 } account;
 
+//Lock profiling counters for one stripe of accounts, each thread keeps its own set
+typedef struct lockStats{
+	long acquisitions;
+	long contended;
+	unsigned long long waitNs;
+	unsigned long long maxWaitNs;
+	unsigned long long holdNs;
+} lockStats;
+
+//A CHECK over many accounts that is split into chunks and served by several workers
+typedef struct bulkCheck{
+	int *ids;
+	int first;
+	int count;
+	int chunksLeft;
+} bulkCheck;
+
+//A LOAD or DUMP, its requests are worked on by several workers a chunk at a time
+struct bulkJob;
+
 typedef struct request{
 	char *command;
 	struct timeval timeStart;
+	struct timeval deadline;
 	int requestId;
+	bulkCheck *bulk;
+	int chunkStart;
+	int chunkLen;
+	struct bulkJob *job;
 	struct request *next;
 } request;
 
@@ -18,5 +50,40 @@ typedef struct queue{
 	request* rear;
 } queue;
 
-void push(char* cmd, int requestId);
+//The accounts and their locks
+extern account *accounts;
+
+void initAccounts(int n, int sparse);
+//Find an account's lock state, with sparse accounts its page is allocated the first time
+account * accountAt(int accountNum);
+//Memory taken by sparse accounts' lock state so far, 0 for dense accounts
+long accountBytes();
+int sortAccounts(int *accountNums, int n);
+int accountIndex(int *accountNums, int n, int accountNum);
+void lockAccounts(int *accountNums, int n);
+void unlockAccounts(int *accountNums, int n);
+void lockProfileInit(int stripes, int numAccounts);
+void lockProfileMetrics(FILE *out);
+void lockProfileReport(FILE *out, int topN);
+
+//The request queue, its lock and the conditions workers and the main thread wait on
+extern queue *q;
+extern pthread_mutex_t queueMutex;
+extern pthread_cond_t queueNotEmpty;
+extern pthread_cond_t queueNotFull;
+extern long expiredRequests;
+extern int lastPushedId;
+
+void queueInit(int maxDepth);
+int queueAdmit(int blockWhenFull);
+void push(char* cmd, int requestId, struct timeval deadline);
+void pushStarted(char* cmd, int requestId, struct timeval timeStart, struct timeval deadline);
+void pushChunks(bulkCheck *bulk, int requestId, struct timeval timeStart);
+void pushJob(struct bulkJob *job, int requestId, struct timeval timeStart);
 request pop();
+request * queueDetach(int *count);
+void queueStats();
+void queueMetrics(FILE *out);
+
+//Delete this later, this is for testing the queue
+void display(request *head);
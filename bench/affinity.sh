@@ -0,0 +1,46 @@
+#!/bin/sh
+# Compare end-to-end throughput with the threads left to the scheduler and pinned with NUMA placement.
+# Uses the server built without storage delay: make appserver-nowait
+# Usage: bench/affinity.sh [requests] [workers] [worker cpus] [ingest cpu]
+# Prints one CSV line per mode: mode,workers,accounts,requests,seconds,requests_per_second
+
+SERVER=${SERVER:-./appserver-nowait}
+REQUESTS=${1:-200000}
+WORKERS=${2:-10}
+CPUS=${3:-0-$(($(nproc) - 1))}
+INGEST=${4:-0}
+ACCOUNTS=${ACCOUNTS:-1000000}
+INPUT=bench_affinity_input.txt
+OUTPUT=bench_affinity_output.txt
+
+# An even mix of single checks and transfers of 1 to 6 pairs over all the accounts
+awk -v n=$REQUESTS -v a=$ACCOUNTS 'BEGIN {
+	srand(5)
+	for (i = 0; i < n; i++) {
+		if (i % 2) {
+			printf "CHECK %d\n", int(rand()*a)+1
+		} else {
+			pairs = int(rand()*6)+1
+			line = "TRANS"
+			for (j = 0; j < pairs; j++)
+				line = line " " int(rand()*a)+1 " " (j % 2 ? -1 : 1)
+			print line
+		}
+	}
+	print "END"
+}' > $INPUT
+
+echo "mode,workers,accounts,requests,seconds,requests_per_second"
+for mode in unpinned pinned; do
+	if [ $mode = pinned ]; then
+		opts="--pin-workers=$CPUS --pin-ingest=$INGEST --numa"
+	else
+		opts=""
+	fi
+	start=$(date +%s.%N)
+	$SERVER $WORKERS $ACCOUNTS $OUTPUT $opts < $INPUT > /dev/null 2>&1
+	end=$(date +%s.%N)
+	echo "$mode $start $end" | awk -v w=$WORKERS -v a=$ACCOUNTS -v n=$REQUESTS \
+		'{ t = $3 - $2; printf "%s,%d,%d,%d,%.3f,%.1f\n", $1, w, a, n, t, n / t }'
+done
+rm -f $INPUT $OUTPUT
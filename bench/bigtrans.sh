@@ -0,0 +1,31 @@
+#!/bin/sh
+# Time one TRANS with more and more account/amount pairs, each on its own account, once with
+# storage latency off (parsing, locking and the balance checks) and once with the default 10 ms
+# per storage call (the batched reads and writes). Both should grow linearly with the pairs.
+# Usage: bench/bigtrans.sh [pair counts] [accounts]
+# Prints one CSV line per run: pairs,latency,line_bytes,seconds,us_per_pair
+
+SERVER=${SERVER:-./appserver}
+PAIRS=${1:-"1000 10000 100000"}
+ACCOUNTS=${2:-100000}
+INPUT=/tmp/bigtrans_bench.in
+
+echo "pairs,latency,line_bytes,seconds,us_per_pair"
+for n in $PAIRS; do
+	awk -v n=$n -v a=$ACCOUNTS 'BEGIN {
+		printf "TRANS"
+		for (i = 0; i < n; i++)
+			printf " %d 0", i % a + 1
+		printf "\nEND\n"
+	}' > $INPUT
+	bytes=$(head -1 $INPUT | wc -c)
+	for latency in none fixed:10000; do
+		start=$(date +%s%N)
+		$SERVER 1 $ACCOUNTS /dev/null --latency=$latency < $INPUT > /dev/null 2>&1
+		end=$(date +%s%N)
+		awk -v n=$n -v l=$latency -v b=$bytes -v ns=$((end-start)) 'BEGIN {
+			printf "%d,%s,%d,%.3f,%.2f\n", n, l, b, ns/1e9, ns/1e3/n
+		}'
+	done
+done
+rm -f $INPUT
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Run the same workload against every concurrency control strategy and compare them side by side.
+# The workload is recorded once as a trace and replayed at full speed with ./replay for each strategy.
+# Usage: bench/cc.sh [requests] [workers] [extra server options]
+# Prints one CSV line per strategy: strategy,workers,accounts,requests,requests_per_second,p50_ms,p99_ms,max_ms
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-2000}
+WORKERS=${2:-10}
+OPTIONS=${3:-}
+ACCOUNTS=${ACCOUNTS:-1000}
+TRACE=bench_cc.trace
+
+# An even mix of single checks and transfers of 1 to 6 pairs, after a deposit into every account
+awk -v n=$REQUESTS -v a=$ACCOUNTS 'BEGIN {
+	srand(5)
+	for (i = 1; i <= a; i += 10) {
+		line = "TRANS"
+		for (j = i; j < i + 10 && j <= a; j++)
+			line = line " " j " 10000"
+		print line
+	}
+	for (i = 0; i < n; i++) {
+		if (i % 2) {
+			printf "CHECK %d\n", int(rand()*a)+1
+		} else {
+			pairs = int(rand()*6)+1
+			line = "TRANS"
+			for (j = 0; j < pairs; j++)
+				line = line " " int(rand()*a)+1 " " int(rand()*200)-100
+			print line
+		}
+	}
+	print "END"
+}' | $SERVER 1 $ACCOUNTS /dev/null --cc=serial --trace=$TRACE > /dev/null 2>&1
+
+echo "strategy,workers,accounts,requests,requests_per_second,p50_ms,p99_ms,max_ms"
+for strategy in serial global 2pl striped occ fifo; do
+	./replay $TRACE max $SERVER $WORKERS $ACCOUNTS "--cc=$strategy $OPTIONS 2>/dev/null" | awk -v s=$strategy -v w=$WORKERS -v a=$ACCOUNTS '
+		/requests per second/ && /results/ { n = $1; rps = $(NF-3) }
+		/^p50/ { p50 = $2; p99 = $6; max = $10 }
+		END { printf "%s,%d,%d,%d,%s,%s,%s,%s\n", s, w, a, n, rps, p50, p99, max }'
+done
+rm -f $TRACE replay_${WORKERS}_${ACCOUNTS}.txt
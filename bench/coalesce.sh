@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compare CHECK-heavy traffic on a few hot accounts with and without --coalesce-checks.
+# The requests are mostly CHECKs of HOT accounts, like dashboards polling the same balances,
+# with a TRANS on one of them every so often. They are all piped in at once and the server runs
+# with the default 10 ms storage latency.
+# Usage: bench/coalesce.sh [requests] [workers] [hot accounts]
+# Prints one CSV line per mode: coalesce,requests,workers,hot,seconds,requests_per_second,check_reads,reads_saved
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-5000}
+WORKERS=${2:-16}
+HOT=${3:-4}
+TRANS_SHARE=${TRANS_SHARE:-0.05}
+INPUT=/tmp/coalesce_bench.in
+
+awk -v n=$REQUESTS -v h=$HOT -v t=$TRANS_SHARE 'BEGIN {
+	srand(11)
+	for (i = 0; i < n; i++) {
+		if (rand() < t)
+			print "TRANS " int(rand()*h)+1 " 1"
+		else
+			print "CHECK " int(rand()*h)+1
+	}
+	print "END"
+}' > $INPUT
+
+checks=$(grep -c CHECK $INPUT)
+
+echo "coalesce,requests,workers,hot,seconds,requests_per_second,check_reads,reads_saved"
+for mode in off on; do
+	options=""
+	[ $mode = on ] && options="--coalesce-checks"
+	start=$(date +%s%N)
+	stats=$($SERVER $WORKERS 1000 /dev/null $options < $INPUT 2>&1 >/dev/null)
+	end=$(date +%s%N)
+	echo "$stats" | awk -v m=$mode -v n=$REQUESTS -v w=$WORKERS -v h=$HOT -v ns=$((end-start)) -v c=$checks '
+		/coalesced checks/ { reads = $3; saved = $9 }
+		END {
+			# without coalescing every CHECK is its own read
+			if (m == "off") { reads = c; saved = 0 }
+			printf "%s,%d,%d,%d,%.2f,%.0f,%s,%s\n", m, n, w, h, ns/1e9, n/(ns/1e9), reads, saved
+		}'
+done
+rm -f $INPUT
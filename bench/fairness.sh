@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compare TRANS tail latency under the default per-account mutexes and the fair fifo locks.
+# The workload is skewed: most picks land on a few hot accounts, and 6 pair transfers that need
+# several of them compete with a stream of single pair ones. It is replayed at a fixed rate.
+# Usage: bench/fairness.sh [requests] [rate per second] [workers]
+# Prints one CSV line per strategy and TRANS size: strategy,pairs,count,p50_ms,p99_ms,p99_9_ms,max_ms
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-4000}
+RATE=${2:-400}
+WORKERS=${3:-10}
+ACCOUNTS=${ACCOUNTS:-1000}
+HOT=${HOT:-8}
+WORKLOAD=bench_fairness.txt
+TRACE=bench_fairness.trace
+
+# 80% of the picks go to the first HOT accounts, one request in ten is a 6 pair transfer
+awk -v n=$REQUESTS -v a=$ACCOUNTS -v hot=$HOT 'BEGIN {
+	srand(9)
+	for (i = 0; i < n; i++) {
+		pairs = i % 10 == 0 ? 6 : 1
+		line = "TRANS"
+		for (j = 0; j < pairs; j++)
+			line = line " " (rand() < 0.8 ? int(rand()*hot)+1 : int(rand()*a)+1) " " int(rand()*200)-100
+		print line
+	}
+	print "END"
+}' > $WORKLOAD
+$SERVER 1 $ACCOUNTS /dev/null --cc=serial --trace=$TRACE < $WORKLOAD > /dev/null 2>&1
+
+echo "strategy,pairs,count,p50_ms,p99_ms,p99_9_ms,max_ms"
+for strategy in 2pl fifo; do
+	./replay $TRACE $RATE/s $SERVER $WORKERS $ACCOUNTS "--cc=$strategy 2>/dev/null" > /dev/null
+	# Request IDs follow the lines of the workload, so the pair count of each result is known
+	awk -v s=$strategy '
+		FNR == NR { pairs[FNR] = (NF-1)/2; next }
+		$2 == "OK" || $2 == "ISF" {
+			p = pairs[$1]
+			lat[p, ++count[p]] = ($(NF) - $(NF-1)) * 1000
+		}
+		function pct(p, q,   i) { i = int(count[p]*q/100 + 0.999); if (i < 1) i = 1; return sorted[i] }
+		END {
+			for (p in count) {
+				for (i = 1; i <= count[p]; i++) sorted[i] = lat[p, i]
+				m = count[p]
+				for (i = 2; i <= m; i++) { v = sorted[i]; for (j = i-1; j >= 1 && sorted[j] > v; j--) sorted[j+1] = sorted[j]; sorted[j+1] = v }
+				printf "%s,%d,%d,%.3f,%.3f,%.3f,%.3f\n", s, p, m, pct(p, 50), pct(p, 99), pct(p, 99.9), sorted[m]
+			}
+		}' $WORKLOAD replay_${WORKERS}_${ACCOUNTS}.txt | sort -t, -k2n
+done
+rm -f $WORKLOAD $TRACE replay_${WORKERS}_${ACCOUNTS}.txt
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Compare loading balances the old way, with TRANS deposits of 10 accounts per line like doInitialDeposits(),
+# against LOAD from a CSV and a binary file, and time DUMP in both formats.
+# Usage: bench/load.sh [accounts] [workers]
+# Prints one CSV line per method: method,workers,accounts,seconds,accounts_per_second
+
+SERVER=${SERVER:-./appserver}
+ACCOUNTS=${1:-20000}
+WORKERS=${2:-10}
+CSV=bench_load.csv
+BIN=bench_load.bin
+
+awk -v a=$ACCOUNTS 'BEGIN { for (i = 1; i <= a; i++) printf "%d,%d\n", i, i % 1000 + 1 }' > $CSV
+
+now() {
+	date +%s.%N
+}
+
+echo "method,workers,accounts,seconds,accounts_per_second"
+
+start=$(now)
+awk -v a=$ACCOUNTS 'BEGIN {
+	for (i = 1; i <= a; i += 10) {
+		line = "TRANS"
+		for (j = i; j < i + 10 && j <= a; j++)
+			line = line " " j " " j % 1000 + 1
+		print line
+	}
+	print "END"
+}' | $SERVER $WORKERS $ACCOUNTS /dev/null > /dev/null 2>&1
+end=$(now)
+echo "trans,$WORKERS,$ACCOUNTS,$start,$end" | awk -F, '{ s = $5 - $4; printf "%s,%d,%d,%.3f,%.0f\n", $1, $2, $3, s, $3 / s }'
+
+# The server reports each LOAD and DUMP with its rate on stderr
+printf 'LOAD %s\nDUMP %s\nEND\n' $CSV $BIN | $SERVER $WORKERS $ACCOUNTS /dev/null 2>&1 > /dev/null | awk -v w=$WORKERS '
+	/ accounts in / { printf "%s_%s,%d,%d,%.3f,%.0f\n", tolower($1), $2 ~ /csv:$/ ? "csv" : "binary", w, $3, $6, $8 }'
+printf 'LOAD %s\nDUMP %s csv\nEND\n' $BIN $CSV | $SERVER $WORKERS $ACCOUNTS /dev/null 2>&1 > /dev/null | awk -v w=$WORKERS '
+	/ accounts in / { printf "%s_%s,%d,%d,%.3f,%.0f\n", tolower($1), $2 ~ /csv:$/ ? "csv" : "binary", w, $3, $6, $8 }'
+rm -f $CSV $BIN
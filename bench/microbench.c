@@ -0,0 +1,223 @@
+/**
+* Microbenchmarks for the bank server's hot paths.
+* Each benchmark prints one CSV line:
+*   benchmark,variant,workers,accounts,iterations,ns_per_op,ops_per_second
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include "../appserver.h"
+#include "../ledger.h"
+#include "../parse.h"
+#include "../results.h"
+
+#define ITERATIONS 200000
+#define E2E_REQUESTS 20000
+
+/* Benchmarks */
+void benchQueue();
+void benchParse(char*, char*);
+void benchLocks(int);
+void benchResults(char*, int, int);
+void benchLedger(int);
+void benchEndToEnd(char*, char*);
+
+/* Helper functions */
+unsigned long long nowNs();
+void report(char*, char*, long, unsigned long long);
+void * lockWorker(void*);
+
+int num_workers = 10;
+int num_accounts = 1000;
+int lock_pairs;
+int lock_profiled = 0;
+
+int main(int argc, char** argv) {
+	int n;
+
+	if (argc > 1)
+		num_workers = atoi(argv[1]);
+	if (argc > 2)
+		num_accounts = atoi(argv[2]);
+
+	printf("benchmark,variant,workers,accounts,iterations,ns_per_op,ops_per_second\n");
+
+	benchQueue();
+	benchParse("check", "CHECK 813");
+	benchParse("trans_6_pairs", "TRANS 12 100 345 -50 678 25 91 -75 234 10 567 -10");
+
+	initAccounts(num_accounts, 0);
+	for (n = 1; n <= 6; n++)
+		benchLocks(n);
+	// the same with the lock profiler counting every acquisition
+	lockProfileInit(4096, num_accounts);
+	lock_profiled = 1;
+	for (n = 1; n <= 6; n++)
+		benchLocks(n);
+
+	benchResults("completion_order", 0, 0);
+	benchResults("request_id_order", 1024, 0);
+	benchResults("completion_order_binary", 0, 1);
+	benchResults("request_id_order_binary", 1024, 1);
+
+	ledgerInit(num_accounts);
+	benchLedger(1);
+	benchLedger(6);
+
+	benchEndToEnd("wait_time_0", "");
+	benchEndToEnd("wait_time_0_ledger", " --ledger");
+	return 0;
+}
+
+unsigned long long nowNs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void report(char *benchmark, char *variant, long iterations, unsigned long long elapsed) {
+	printf("%s,%s,%d,%d,%ld,%.1f,%.0f\n", benchmark, variant, num_workers, num_accounts, iterations,
+		(double) elapsed / iterations, iterations / (elapsed / 1e9));
+	fflush(stdout);
+}
+
+// one push and one pop under the queue lock, the way the main thread and a worker do it
+void benchQueue() {
+	struct timeval noDeadline = {0, 0};
+	int i;
+	queueInit(0);
+	unsigned long long start = nowNs();
+	for (i = 0; i < ITERATIONS; i++) {
+		pthread_mutex_lock(&queueMutex);
+		push("TRANS 12 100 345 -50", i, noDeadline);
+		pthread_mutex_unlock(&queueMutex);
+
+		pthread_mutex_lock(&queueMutex);
+		request req = pop();
+		pthread_mutex_unlock(&queueMutex);
+		free(req.command);
+	}
+	report("queue_push_pop", "single_thread", ITERATIONS, nowNs() - start);
+}
+
+// splitting a request into parts and reading its TRANS pairs
+void benchParse(char *variant, char *line) {
+	char copy[1024];
+	int accountNums[8], amounts[8];
+	int i;
+	volatile int sink = 0;
+	unsigned long long start = nowNs();
+	for (i = 0; i < ITERATIONS; i++) {
+		strcpy(copy, line);
+		int spaces = countSpaces(copy);
+		char *command[spaces + 2];
+		int parts = splitCommand(copy, command, spaces);
+		if (strcmp(command[0], "TRANS") == 0)
+			sink += parseTrans(command, parts, accountNums, amounts);
+		else
+			sink += atoi(command[1]);
+	}
+	report("parse", variant, ITERATIONS, nowNs() - start);
+}
+
+void * lockWorker(void *arg) {
+	unsigned int seed = (unsigned long) arg;
+	int ids[6];
+	int i, j;
+	for (i = 0; i < ITERATIONS / num_workers; i++) {
+		for (j = 0; j < lock_pairs; j++)
+			ids[j] = rand_r(&seed) % num_accounts + 1;
+		int n = sortAccounts(ids, lock_pairs);
+		lockAccounts(ids, n);
+		unlockAccounts(ids, n);
+	}
+	return NULL;
+}
+
+// sorting and locking the accounts of a TRANS with [pairs] pairs, all workers at once
+void benchLocks(int pairs) {
+	pthread_t threads[num_workers];
+	char variant[32];
+	long i;
+	lock_pairs = pairs;
+	unsigned long long start = nowNs();
+	for (i = 0; i < num_workers; i++)
+		pthread_create(&threads[i], NULL, lockWorker, (void*) (i + 1));
+	for (i = 0; i < num_workers; i++)
+		pthread_join(threads[i], NULL);
+	sprintf(variant, "%d_accounts%s", pairs, lock_profiled ? "_profiled" : "");
+	report("lock_acquire", variant, ITERATIONS / num_workers * num_workers, nowNs() - start);
+}
+
+// encoding a result and handing it to the writer, the output goes to /dev/null
+void benchResults(char *variant, int window, int binary) {
+	FILE *out = fopen("/dev/null", "w");
+	struct timeval started, finished;
+	char result[128];
+	int i;
+	resultsInit(out, window, binary);
+	gettimeofday(&started, NULL);
+	unsigned long long start = nowNs();
+	for (i = 1; i <= ITERATIONS; i++) {
+		gettimeofday(&finished, NULL);
+		int len = resultEncode(result, i, RESULT_OK, 0, 0, started, finished);
+		resultWrite(i, result, len, 1);
+	}
+	resultsClose(ITERATIONS);
+	report("result_write", variant, ITERATIONS, nowNs() - start);
+	fclose(out);
+}
+
+// appending the ledger entries of a committed TRANS with [pairs] pairs
+void benchLedger(int pairs) {
+	int ids[6], balances[6], amounts[6];
+	char variant[32];
+	unsigned int seed = 7;
+	int i, j;
+	unsigned long long start = nowNs();
+	for (i = 0; i < ITERATIONS; i++) {
+		for (j = 0; j < pairs; j++) {
+			ids[j] = rand_r(&seed) % num_accounts + 1;
+			amounts[j] = j % 2 ? -1 : 1;
+		}
+		int n = sortAccounts(ids, pairs);
+		for (j = 0; j < n; j++)
+			balances[j] = i;
+		ledgerCommit(i + 1, ids, balances, n, ids, amounts, n);
+	}
+	sprintf(variant, "%d_accounts", pairs);
+	report("ledger_append", variant, ITERATIONS, nowNs() - start);
+}
+
+// the whole server built with no storage delay, from the first request sent until it exits
+void benchEndToEnd(char *variant, char *options) {
+	char command[300];
+	int i, j;
+	sprintf(command, "./appserver-nowait %d %d bench_e2e_output.txt%s > /dev/null 2>&1", num_workers, num_accounts, options);
+	srand(5);
+	unsigned long long start = nowNs();
+	FILE *pipe = popen(command, "w");
+	if (pipe == NULL) {
+		printf("Error: popen(%s) failed.\n", command);
+		return;
+	}
+	for (i = 0; i < E2E_REQUESTS; i++) {
+		if (i % 2) {
+			fprintf(pipe, "CHECK %d\n", rand() % num_accounts + 1);
+		} else {
+			int pairs = rand() % 6 + 1;
+			fprintf(pipe, "TRANS");
+			for (j = 0; j < pairs; j++)
+				fprintf(pipe, " %d %d", rand() % num_accounts + 1, j % 2 ? -1 : 1);
+			fprintf(pipe, "\n");
+		}
+	}
+	fprintf(pipe, "END\n");
+	pclose(pipe);
+	report("end_to_end", variant, E2E_REQUESTS, nowNs() - start);
+	remove("bench_e2e_output.txt");
+}
@@ -0,0 +1,118 @@
+#!/bin/sh
+# Run the modes that hand results to the writer from more than one place with --ordered and a
+# few window sizes, and check that each run ends and every request gets exactly one result.
+# A run that is still going after LIMIT seconds counts as hung.
+# Usage: bench/ordered.sh [requests] [workers]
+# Prints one CSV line per run: case,window,requests,results,seconds,status
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-3000}
+WORKERS=${2:-4}
+LIMIT=${LIMIT:-60}
+INPUT=/tmp/bench_ordered.in
+OUTPUT=/tmp/bench_ordered.out
+FILE=/tmp/bench_ordered.csv
+FEED=/tmp/bench_ordered.fifo
+SOCKET=/tmp/bench_ordered.sock
+
+# check <case> <window> <accounts> <options>: run the server on INPUT, or on SOURCE when set, and check its output
+check() {
+	expected=$(grep -vc '^END$' $INPUT)
+	rm -f $OUTPUT
+	start=$(date +%s%N)
+	timeout $LIMIT $SERVER $WORKERS $3 $OUTPUT --ordered=$2 $4 < ${SOURCE:-$INPUT} > /dev/null 2>&1
+	rc=$?
+	end=$(date +%s%N)
+	# A result line starts with its request ID and has TIME, the account lines of a bulk block don't
+	results=$(grep ' TIME ' $OUTPUT 2>/dev/null | awk '{ print $1 }' | sort -n | uniq -u | wc -l)
+	status=ok
+	[ $rc -eq 124 ] && status=hung
+	[ $rc -ne 124 ] && [ $results -ne $expected ] && status=wrong
+	echo "$1,$2,$expected,$results,$(awk -v ns=$((end-start)) 'BEGIN { printf "%.2f", ns/1e9 }'),$status"
+}
+
+echo "case,window,requests,results,seconds,status"
+
+# A DUMP and a LOAD of a million accounts, each followed by CHECKs that finish before the job does
+for job in "DUMP $FILE" "LOAD $FILE"; do
+	awk -v n=$REQUESTS -v job="$job" 'BEGIN {
+		print job
+		for (i = 1; i < n; i++)
+			print "CHECK 1"
+		print "END"
+	}' > $INPUT
+	for window in 4 1024; do
+		check "$(echo $job | cut -d' ' -f1 | tr A-Z a-z)" $window 1000000 "--latency=none"
+	done
+done
+
+# CHECKs sent while a LOAD runs should finish before it, the LOAD only gets half of the workers
+# Here results is the number of CHECKs that finished before LOADED, and window 0 is completion order
+awk 'BEGIN { for (i = 1; i <= 200000; i++) printf "%d,%d\n", i, i % 100 }' > $FILE
+printf 'LOAD %s\n' $FILE > $INPUT
+awk 'BEGIN { for (i = 1; i <= 20; i++) print "CHECK " i; print "END" }' > $INPUT.checks
+for window in 0 1024; do
+	rm -f $FEED $OUTPUT
+	mkfifo $FEED
+	(cat $INPUT; sleep 0.2; cat $INPUT.checks) > $FEED &
+	ordered=""
+	[ $window -gt 0 ] && ordered="--ordered=$window"
+	start=$(date +%s%N)
+	timeout $LIMIT $SERVER $WORKERS 200000 $OUTPUT $ordered --latency=fixed:2000 < $FEED > /dev/null 2>&1
+	rc=$?
+	end=$(date +%s%N)
+	wait
+	awk -v w=$window -v rc=$rc -v ns=$((end-start)) '
+		$2 == "LOADED" { loaded = $NF }
+		$2 == "BAL" { finished[++n] = $NF }
+		END {
+			for (i = 1; i <= n; i++)
+				if (finished[i] < loaded)
+					before++
+			status = rc == 124 ? "hung" : (n == 20 && before == n ? "ok" : "wrong")
+			printf "load_fairness,%d,%d,%d,%.2f,%s\n", w, 20, before, ns/1e9, status
+		}' $OUTPUT
+done
+rm -f $INPUT.checks
+
+# CHECKs of one account joining each other's reads
+awk -v n=$REQUESTS 'BEGIN { for (i = 0; i < n; i++) print "CHECK 1"; print "END" }' > $INPUT
+for window in 4 16 1024; do
+	check coalesce $window 10 "--coalesce-checks --latency=fixed:1000"
+done
+
+# TRANSs and CHECKs through the pipeline stages, whose queues hold more than a small window
+awk -v n=$REQUESTS 'BEGIN {
+	srand(2)
+	for (i = 0; i < n; i += 2) {
+		printf "TRANS %d 5 %d -1\n", int(rand()*100)+1, int(rand()*100)+1
+		printf "CHECK %d\n", int(rand()*100)+1
+	}
+	print "END"
+}' > $INPUT
+for window in 4 64; do
+	check pipeline $window 100 "--pipeline=1,2,1 --latency=fixed:500"
+done
+
+# CHECKs answered by a read replica, whose workers answer them out of order
+# The input goes through a FIFO that is only written once the replica has connected
+awk -v n=$REQUESTS 'BEGIN {
+	srand(4)
+	for (i = 0; i < n; i += 8) {
+		printf "TRANS %d 5\n", int(rand()*50)+1
+		for (j = 0; j < 7; j++)
+			printf "CHECK %d\n", int(rand()*50)+1
+	}
+	print "END"
+}' > $INPUT
+for window in 4 64; do
+	rm -f $FEED $SOCKET
+	mkfifo $FEED
+	(sleep 1; cat $INPUT) > $FEED &
+	SOURCE=$FEED check replica $window 50 "--replicate=$SOCKET --replica-checks" &
+	sleep 0.5
+	timeout $LIMIT $SERVER 8 50 /dev/null --replica-of=$SOCKET --latency=lognormal:3000:1 > /dev/null 2>&1
+	wait
+done
+
+rm -f $INPUT $OUTPUT $FILE $FEED $SOCKET
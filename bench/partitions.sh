@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare router throughput with 1, 2, 4 and 8 partition server processes on the same workload.
+# The workload is recorded once as a trace and replayed at full speed with ./replay for each count.
+# Usage: bench/partitions.sh [requests] [coordinators] [partition server]
+# Prints one CSV line per partition count: partitions,coordinators,accounts,requests,requests_per_second,p50_ms,p99_ms,max_ms
+
+REQUESTS=${1:-20000}
+COORDINATORS=${2:-10}
+SERVER=${3:-./appserver-nowait}
+ACCOUNTS=${ACCOUNTS:-100000}
+TRACE=bench_partitions.trace
+
+# An even mix of single checks and transfers of 1 to 6 pairs, after a deposit into every account
+awk -v n=$REQUESTS -v a=$ACCOUNTS 'BEGIN {
+	srand(5)
+	for (i = 1; i <= a; i += 10) {
+		line = "TRANS"
+		for (j = i; j < i + 10 && j <= a; j++)
+			line = line " " j " 10000"
+		print line
+	}
+	for (i = 0; i < n; i++) {
+		if (i % 2) {
+			printf "CHECK %d\n", int(rand()*a)+1
+		} else {
+			pairs = int(rand()*6)+1
+			line = "TRANS"
+			for (j = 0; j < pairs; j++)
+				line = line " " int(rand()*a)+1 " " int(rand()*200)-100
+			print line
+		}
+	}
+	print "END"
+}' | $SERVER 1 $ACCOUNTS /dev/null --trace=$TRACE > /dev/null 2>&1
+
+echo "partitions,coordinators,accounts,requests,requests_per_second,p50_ms,p99_ms,max_ms"
+for partitions in 1 2 4 8; do
+	./replay $TRACE max ./router $COORDINATORS $ACCOUNTS "--partitions=$partitions --server=$SERVER 2>/dev/null" | awk -v p=$partitions -v c=$COORDINATORS -v a=$ACCOUNTS '
+		/requests per second/ && /results/ { n = $1; rps = $(NF-3) }
+		/^p50/ { p50 = $2; p99 = $6; max = $10 }
+		END { printf "%d,%d,%d,%d,%s,%s,%s,%s\n", p, c, a, n, rps, p50, p99, max }'
+done
+rm -f $TRACE replay_${COORDINATORS}_${ACCOUNTS}.txt
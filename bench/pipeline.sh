@@ -0,0 +1,49 @@
+#!/bin/sh
+# Compare the usual workers with pipeline stage sizes on one workload under a storage latency model.
+# The workload is recorded once as a trace and replayed at full speed with ./replay for each setup.
+# Usage: bench/pipeline.sh [requests] [latency model]
+# Prints one CSV line per setup: setup,requests,requests_per_second,p50_ms,p99_ms,max_ms
+# and the stage statistics of each pipelined run on stderr.
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-4000}
+LATENCY=${2:-lognormal:300:0.5}
+ACCOUNTS=${ACCOUNTS:-1000}
+TRACE=bench_pipeline.trace
+
+# An even mix of single checks and transfers of 1 to 6 pairs, after a deposit into every account
+awk -v n=$REQUESTS -v a=$ACCOUNTS 'BEGIN {
+	srand(5)
+	for (i = 1; i <= a; i += 10) {
+		line = "TRANS"
+		for (j = i; j < i + 10 && j <= a; j++)
+			line = line " " j " 10000"
+		print line
+	}
+	for (i = 0; i < n; i++) {
+		if (i % 2) {
+			printf "CHECK %d\n", int(rand()*a)+1
+		} else {
+			pairs = int(rand()*6)+1
+			line = "TRANS"
+			for (j = 0; j < pairs; j++)
+				line = line " " int(rand()*a)+1 " " int(rand()*200)-100
+			print line
+		}
+	}
+	print "END"
+}' | $SERVER 1 $ACCOUNTS /dev/null --cc=serial --latency=none --trace=$TRACE > /dev/null 2>&1
+
+echo "setup,requests,requests_per_second,p50_ms,p99_ms,max_ms"
+# workers and options, the setups use about the same number of threads
+for setup in "16:--cc=fifo" "4:--pipeline=2,8,2" "2:--pipeline=2,12,1" "2:--pipeline=1,16,1"; do
+	workers=${setup%%:*}
+	options=${setup#*:}
+	./replay $TRACE max $SERVER $workers $ACCOUNTS "$options --latency=$LATENCY 2>bench_pipeline.err" | awk -v s="$workers workers $options" '
+		/requests per second/ && /results/ { n = $1; rps = $(NF-3) }
+		/^p50/ { p50 = $2; p99 = $6; max = $10 }
+		END { printf "%s,%d,%s,%s,%s,%s\n", s, n, rps, p50, p99, max }'
+	grep "^stage" bench_pipeline.err >&2
+	rm -f replay_${workers}_${ACCOUNTS}.txt
+done
+rm -f $TRACE bench_pipeline.err
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Compare server throughput with results written in completion order and in request ID order.
+# Usage: bench/reorder.sh [requests] [workers] [window]
+# Prints one CSV line per mode: mode,workers,accounts,requests,seconds,requests_per_second
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-2000}
+WORKERS=${2:-10}
+WINDOW=${3:-64}
+ACCOUNTS=1000
+INPUT=bench_reorder_input.txt
+OUTPUT=bench_reorder_output.txt
+
+# An even mix of single checks and transfers of 1 to 6 pairs
+awk -v n=$REQUESTS -v a=$ACCOUNTS 'BEGIN {
+	srand(5)
+	for (i = 0; i < n; i++) {
+		if (i % 2) {
+			printf "CHECK %d\n", int(rand()*a)+1
+		} else {
+			pairs = int(rand()*6)+1
+			line = "TRANS"
+			for (j = 0; j < pairs; j++)
+				line = line " " int(rand()*a)+1 " " (j % 2 ? -1 : 1)
+			print line
+		}
+	}
+	print "END"
+}' > $INPUT
+
+echo "mode,workers,accounts,requests,seconds,requests_per_second"
+for mode in completion ordered; do
+	if [ $mode = ordered ]; then
+		opts="--ordered=$WINDOW"
+	else
+		opts=""
+	fi
+	start=$(date +%s.%N)
+	$SERVER $WORKERS $ACCOUNTS $OUTPUT $opts < $INPUT > /dev/null
+	end=$(date +%s.%N)
+	echo "$mode $start $end" | awk -v w=$WORKERS -v a=$ACCOUNTS -v n=$REQUESTS \
+		'{ t = $3 - $2; printf "%s,%d,%d,%d,%.3f,%.1f\n", $1, w, a, n, t, n / t }'
+done
+rm -f $INPUT $OUTPUT
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Measure the pause of hot restarts under load. The server reads a stream of CHECKs and TRANSs
+# from a FIFO as fast as its bounded queue lets it, and is replaced RESTARTS times, once every
+# INTERVAL seconds, by a new server started with --takeover.
+# Usage: bench/restart.sh [requests] [restarts] [workers]
+# Prints one CSV line per restart: restart,queued,input_bytes,pause_ms,finishing_ms
+# then the longest time between two results the whole run, and whether every request got exactly one result.
+
+SERVER=${SERVER:-./appserver}
+REQUESTS=${1:-40000}
+RESTARTS=${2:-3}
+WORKERS=${3:-8}
+INTERVAL=${INTERVAL:-1}
+OPTIONS=${OPTIONS:-"--latency=fixed:1000 --max-queue=1000"}
+SOCKET=/tmp/bench_restart.sock
+INPUT=/tmp/bench_restart.in
+OUTPUT=bench_restart.txt
+ERRORS=/tmp/bench_restart.err
+
+rm -f $INPUT $SOCKET $ERRORS
+mkfifo $INPUT
+awk -v n=$REQUESTS 'BEGIN {
+	srand(3)
+	for (i = 0; i < n; i++) {
+		if (i % 2)
+			printf "CHECK %d\n", int(rand()*1000)+1
+		else
+			printf "TRANS %d 1 %d 1\n", int(rand()*1000)+1, int(rand()*1000)+1
+	}
+	print "END"
+}' > $INPUT &
+
+$SERVER $WORKERS 1000 $OUTPUT --handover=$SOCKET $OPTIONS < $INPUT > /dev/null 2>>$ERRORS &
+for k in $(seq $RESTARTS); do
+	sleep $INTERVAL
+	$SERVER $WORKERS 1000 /dev/null --takeover=$SOCKET $OPTIONS < /dev/null 2>>$ERRORS &
+done
+wait
+
+echo "restart,queued,input_bytes,pause_ms,finishing_ms"
+awk '/^handover:/ { n++; gsub(/\(/, ""); printf "%d,%s,%s,%s,%s\n", n, $2, $6, $16, $18 }' $ERRORS
+gap=$(awk '$2 == "OK" || $2 == "BAL" || $2 == "ISF" { print $NF }' $OUTPUT | sort -n | awk '
+	NR > 1 && $1-last > gap { gap = $1-last }
+	{ last = $1 }
+	END { printf "%.2f", gap*1000 }')
+awk -v n=$REQUESTS -v gap=$gap '
+	$2 == "OK" || $2 == "BAL" || $2 == "ISF" { seen[$1]++ }
+	END {
+		for (id = 1; id <= n; id++) if (seen[id] != 1) bad++
+		printf "longest gap between results %s ms, %d of %d requests without exactly one result\n", gap, bad, n
+	}' $OUTPUT
+rm -f $INPUT $SOCKET $ERRORS $OUTPUT
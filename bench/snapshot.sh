@@ -0,0 +1,46 @@
+#!/bin/sh
+# Measure what snapshots cost the foreground traffic: the same paced workload is replayed without
+# snapshots and with a SNAPSHOT every so many requests, and the latency percentiles are compared.
+# Uses the server built without storage delay: make appserver-nowait replay
+# Usage: bench/snapshot.sh [requests] [requests per second] [snapshot every] [workers]
+# Prints one CSV line per run: variant,workers,accounts,requests,rate,p50_ms,p99_ms,max_ms
+
+SERVER=${SERVER:-./appserver-nowait}
+REQUESTS=${1:-50000}
+RATE=${2:-10000}
+EVERY=${3:-10000}
+WORKERS=${4:-4}
+ACCOUNTS=${ACCOUNTS:-1000000}
+SNAPSHOT=bench_snapshot.bin
+
+echo "variant,workers,accounts,requests,rate,p50_ms,p99_ms,max_ms"
+for every in 0 $EVERY; do
+	# An even mix of single checks and transfers of 1 to 6 pairs, recorded as a trace to replay at a fixed rate
+	awk -v n=$REQUESTS -v a=$ACCOUNTS -v every=$every -v file=$SNAPSHOT 'BEGIN {
+		srand(5)
+		for (i = 0; i < n; i++) {
+			if (every > 0 && i % every == every / 2)
+				print "SNAPSHOT " file
+			if (i % 2) {
+				printf "CHECK %d\n", int(rand()*a)+1
+			} else {
+				pairs = int(rand()*6)+1
+				line = "TRANS"
+				for (j = 0; j < pairs; j++)
+					line = line " " int(rand()*a)+1 " " (j % 2 ? -1 : 1)
+				print line
+			}
+		}
+		print "END"
+	}' | $SERVER 1 $ACCOUNTS /dev/null --trace=bench_snapshot.trace > /dev/null 2>&1
+
+	if [ $every = 0 ]; then
+		variant=none
+	else
+		variant=every_$every
+	fi
+	./replay bench_snapshot.trace $RATE/s $SERVER $WORKERS $ACCOUNTS "2>/dev/null" | awk -v v=$variant -v w=$WORKERS -v a=$ACCOUNTS -v n=$REQUESTS -v r=$RATE '
+		/^p50/ { p50 = $2; p99 = $6; max = $10 }
+		END { printf "%s,%d,%d,%d,%d,%s,%s,%s\n", v, w, a, n, r, p50, p99, max }'
+done
+rm -f bench_snapshot.trace $SNAPSHOT replay_${WORKERS}_${ACCOUNTS}.txt
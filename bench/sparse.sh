@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compare startup time and memory of the dense and sparse account layouts.
+# Each run deposits into TOUCHED accounts (RANDOM_TOUCHED for the random pattern) and ends, the server reports how long setting up the
+# accounts took and its peak resident memory on stderr. The touched accounts are either runs of
+# 1000 consecutive IDs at random places (clustered, like accounts opened around the same time)
+# or spread uniformly over every ID (random, the worst case for pages).
+# Usage: bench/sparse.sh [accounts ...]
+# Prints one CSV line per layout, size and pattern: layout,accounts,touched,pattern,startup_ms,peak_rss_mb
+# Dense runs above DENSE_MAX accounts are skipped, at 1 billion they need about 60 GB.
+
+SERVER=${SERVER:-./appserver}
+TOUCHED=${TOUCHED:-1000000}
+RANDOM_TOUCHED=${RANDOM_TOUCHED:-100000}
+DENSE_MAX=${DENSE_MAX:-50000000}
+SIZES=${*:-"1000000 50000000 1000000000"}
+
+echo "layout,accounts,touched,pattern,startup_ms,peak_rss_mb"
+for accounts in $SIZES; do
+	for layout in dense sparse; do
+		if [ $layout = dense ] && [ $accounts -gt $DENSE_MAX ]; then
+			continue
+		fi
+		for pattern in clustered random; do
+			touched=$TOUCHED
+			[ $pattern = random ] && touched=$RANDOM_TOUCHED
+			options="--latency=none"
+			[ $layout = sparse ] && options="$options --sparse"
+			# 20 deposits per TRANS
+			awk -v n=$touched -v a=$accounts -v p=$pattern 'BEGIN {
+				srand(7)
+				for (i = 0; i < n; i += 20) {
+					line = "TRANS"
+					for (j = i; j < i + 20 && j < n; j++) {
+						if (p == "random") {
+							id = int(rand()*a)+1
+						} else {
+							if (j % 1000 == 0)
+								start = int(rand()*(a > 1000 ? a-1000 : 1))
+							id = start + j % 1000 + 1
+						}
+						line = line " " id " 100"
+					}
+					print line
+				}
+				print "END"
+			}' | $SERVER 4 $accounts /dev/null $options 2>&1 >/dev/null | awk -v l=$layout -v a=$accounts -v t=$touched -v p=$pattern '
+				/set up in/ { startup = $(NF-1) }
+				/peak RSS/ { rss = $(NF-1) }
+				END { printf "%s,%d,%d,%s,%s,%s\n", l, a, t, p, startup, rss }'
+		done
+	done
+done
@@ -0,0 +1,340 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "bulkio.h"
+#include "cc.h"
+#include "replica.h"
+#include "results.h"
+#include "snapshot.h"
+#include "storage.h"
+
+unsigned long long monotonicNs();
+
+//A LOAD or DUMP in progress, the file and the position in it are only touched under mutex
+typedef struct bulkJob{
+	int load;
+	int binary;
+	FILE *file;
+	char path[1024];
+	pthread_mutex_t mutex;
+	//Turns still queued or being worked on, the last one to find no work left finishes the job
+	int turns;
+	//Next account a DUMP reads
+	int nextAccount;
+	//The binary run a LOAD is in the middle of
+	int runNext;
+	int runLeft;
+	//The CSV line a LOAD reads into
+	char *line;
+	size_t lineSize;
+	long accountsDone;
+	long skipped;
+	unsigned long long started;
+	unsigned long long lastProgress;
+} bulkJob;
+
+//One account and balance read from a LOAD file, order is its position in the chunk
+typedef struct loadRecord{
+	int id;
+	int value;
+	int order;
+} loadRecord;
+
+int bulkParallel = 1;
+int bulkAccounts;
+
+void bulkIoInit(int parallel, int count){
+	//Half the workers at most, the others keep serving the rest of the traffic
+	bulkParallel = parallel/2 > 0 ? parallel/2 : 1;
+	bulkAccounts = count;
+}
+
+int readLE32(FILE *file, int *value){
+	unsigned char b[4];
+	if(fread(b, 1, 4, file) != 4){
+		return 0;
+	}
+	*value = (int) (b[0] | b[1]<<8 | b[2]<<16 | (unsigned) b[3]<<24);
+	return 1;
+}
+
+void writeLE32(char *out, int value){
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+//Write the result of a LOAD or DUMP, with the number of accounts or the reason it failed
+void bulkResult(int requestId, struct timeval timeStart, int type, int value){
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+	char result[128];
+	int len = resultEncode(result, requestId, type, value, 0, timeStart, finished);
+	resultWrite(requestId, result, len, 1);
+}
+
+//Queue the first turns of a job, as many as may run at the same time
+void queueTurns(bulkJob *job, int requestId, struct timeval timeStart){
+	int k;
+	pthread_mutex_init(&job->mutex, NULL);
+	job->turns = bulkParallel;
+	job->accountsDone = 0;
+	job->skipped = 0;
+	job->started = monotonicNs();
+	job->lastProgress = job->started;
+
+	pthread_mutex_lock(&queueMutex);
+	for(k=0; k<bulkParallel; k++){
+		pushJob(job, requestId, timeStart);
+	}
+	pthread_cond_broadcast(&queueNotEmpty);
+	pthread_mutex_unlock(&queueMutex);
+}
+
+void startLoad(int requestId, struct timeval timeStart, char *path){
+	FILE *file = fopen(path, "r");
+	if(file == NULL){
+		bulkResult(requestId, timeStart, RESULT_ERROR, ERROR_OPEN);
+		return;
+	}
+
+	bulkJob *job = calloc(1, sizeof(bulkJob));
+	job->load = 1;
+	job->file = file;
+	strncpy(job->path, path, sizeof(job->path)-1);
+	//Binary files start with their header, anything else is read as CSV
+	char header[8];
+	if(fread(header, 1, 8, file) == 8 && memcmp(header, "BANKBAL1", 8) == 0){
+		job->binary = 1;
+	} else {
+		rewind(file);
+	}
+	queueTurns(job, requestId, timeStart);
+}
+
+void startDump(int requestId, struct timeval timeStart, char *path, char *format){
+	int binary;
+	if(format){
+		binary = strcmp(format, "csv") != 0;
+	} else {
+		binary = strlen(path) < 4 || strcmp(path+strlen(path)-4, ".csv") != 0;
+	}
+
+	FILE *file = fopen(path, "w");
+	if(file == NULL){
+		bulkResult(requestId, timeStart, RESULT_ERROR, ERROR_CREATE);
+		return;
+	}
+
+	bulkJob *job = calloc(1, sizeof(bulkJob));
+	job->load = 0;
+	job->binary = binary;
+	job->file = file;
+	job->nextAccount = 1;
+	strncpy(job->path, path, sizeof(job->path)-1);
+	if(binary){
+		fwrite("BANKBAL1", 1, 8, file);
+	} else {
+		fprintf(file, "account,balance\n");
+	}
+	queueTurns(job, requestId, timeStart);
+}
+
+//Read up to a chunk of records from a LOAD file, called under the job's mutex
+int readRecords(bulkJob *job, loadRecord *records){
+	int n = 0;
+	while(n < BULK_CHUNK){
+		if(job->binary){
+			if(job->runLeft == 0){
+				if(!readLE32(job->file, &job->runNext) || !readLE32(job->file, &job->runLeft)){
+					break;
+				}
+				//Skip over metadata
+				if(job->runNext == 0){
+					fseek(job->file, (long) job->runLeft*4, SEEK_CUR);
+					job->runLeft = 0;
+				}
+				continue;
+			}
+			//A run cut short ends the file
+			if(!readLE32(job->file, &records[n].value)){
+				job->runLeft = 0;
+				break;
+			}
+			records[n].id = job->runNext;
+			job->runNext++;
+			job->runLeft--;
+		} else {
+			if(getline(&job->line, &job->lineSize, job->file) <= 0){
+				break;
+			}
+			if(sscanf(job->line, "%d%*[,; \t]%d", &records[n].id, &records[n].value) != 2){
+				continue;
+			}
+		}
+		records[n].order = n;
+		n++;
+	}
+	return n;
+}
+
+int compareRecords(const void *a, const void *b){
+	const loadRecord *x = a;
+	const loadRecord *y = b;
+	if(x->id != y->id){
+		return x->id < y->id ? -1 : 1;
+	}
+	return x->order - y->order;
+}
+
+//Set a chunk of balances with one storage call, returns how many were skipped for not being accounts
+int loadChunk(loadRecord *records, int n){
+	int ids[BULK_CHUNK];
+	int values[BULK_CHUNK];
+	unsigned versions[BULK_CHUNK];
+	int count = 0;
+	int j;
+
+	//Accounts are locked in increasing order without duplicates, the last balance given for an account wins
+	qsort(records, n, sizeof(loadRecord), compareRecords);
+	for(j=0; j<n; j++){
+		if(records[j].id < 1 || records[j].id > bulkAccounts){
+			continue;
+		}
+		if(count > 0 && ids[count-1] == records[j].id){
+			count--;
+		}
+		ids[count] = records[j].id;
+		values[count] = records[j].value;
+		count++;
+	}
+	if(count == 0){
+		return n;
+	}
+
+	do{
+		cc->begin(ids, count, versions);
+	} while(!cc->validate(ids, count, versions));
+	//Snapshots are held off only once the accounts are, like a TRANS does
+	snapshotWriteBegin();
+	storageWriteBatch(ids, count, values);
+	replicateCommit(ids, count, values);
+	snapshotWriteEnd();
+	cc->end(ids, count, 1);
+	return n - count;
+}
+
+//Read a chunk of balances with one storage call and append them to the dump
+void dumpChunk(bulkJob *job, int first, int n){
+	int ids[BULK_CHUNK];
+	int values[BULK_CHUNK];
+	unsigned versions[BULK_CHUNK];
+	int j;
+
+	for(j=0; j<n; j++){
+		ids[j] = first+j;
+	}
+	do{
+		cc->begin(ids, n, versions);
+		storageReadBatch(ids, n, values);
+	} while(!cc->validate(ids, n, versions));
+	cc->end(ids, n, 0);
+
+	//Format the whole chunk first so it goes into the file with a single write
+	char block[8 + BULK_CHUNK*24];
+	int len = 0;
+	if(job->binary){
+		writeLE32(block, first);
+		writeLE32(block+4, n);
+		for(j=0; j<n; j++){
+			writeLE32(block+8+j*4, values[j]);
+		}
+		len = 8 + n*4;
+	} else {
+		for(j=0; j<n; j++){
+			len += sprintf(block+len, "%d,%d\n", ids[j], values[j]);
+		}
+	}
+	pthread_mutex_lock(&job->mutex);
+	fwrite(block, 1, len, job->file);
+	pthread_mutex_unlock(&job->mutex);
+}
+
+void processBulkJob(bulkJob *job, int requestId, struct timeval timeStart){
+	loadRecord records[BULK_CHUNK];
+	int first = 0;
+	int n;
+
+	//Take the next chunk of the file or of the accounts
+	pthread_mutex_lock(&job->mutex);
+	if(job->load){
+		n = readRecords(job, records);
+	} else {
+		first = job->nextAccount;
+		n = bulkAccounts-first+1 < BULK_CHUNK ? bulkAccounts-first+1 : BULK_CHUNK;
+		if(n < 0){
+			n = 0;
+		}
+		job->nextAccount += n;
+	}
+	pthread_mutex_unlock(&job->mutex);
+
+	if(n > 0){
+		int skipped = 0;
+		if(job->load){
+			skipped = loadChunk(records, n);
+		} else {
+			dumpChunk(job, first, n);
+		}
+
+		//Report progress about once a second
+		unsigned long long now = monotonicNs();
+		pthread_mutex_lock(&job->mutex);
+		job->accountsDone += n - skipped;
+		job->skipped += skipped;
+		if(now - job->lastProgress >= 1000000000ULL){
+			job->lastProgress = now;
+			double elapsed = (now - job->started)/1e9;
+			fprintf(stderr, "%s %s: %ld accounts so far, %.0f accounts/s\n", job->load ? "LOAD" : "DUMP", job->path, job->accountsDone, job->accountsDone/elapsed);
+		}
+		pthread_mutex_unlock(&job->mutex);
+
+		//Queue the next turn, at the front only with --ordered
+		pthread_mutex_lock(&queueMutex);
+		pushJob(job, requestId, timeStart);
+		pthread_cond_signal(&queueNotEmpty);
+		pthread_mutex_unlock(&queueMutex);
+		return;
+	}
+
+	//No work left for this turn, the last turn to finish completes the request
+	pthread_mutex_lock(&job->mutex);
+	job->turns--;
+	int last = job->turns == 0;
+	pthread_mutex_unlock(&job->mutex);
+	if(!last){
+		return;
+	}
+
+	int failed = ferror(job->file);
+	failed |= fclose(job->file) != 0;
+	double elapsed = (monotonicNs() - job->started)/1e9;
+	fprintf(stderr, "%s %s: %ld accounts in %.3f s, %.0f accounts/s", job->load ? "LOAD" : "DUMP", job->path, job->accountsDone, elapsed, elapsed > 0 ? job->accountsDone/elapsed : 0);
+	if(job->skipped > 0){
+		fprintf(stderr, ", skipped %ld records for accounts that don't exist", job->skipped);
+	}
+	fputc('\n', stderr);
+
+	if(failed){
+		bulkResult(requestId, timeStart, RESULT_ERROR, job->load ? ERROR_READ : ERROR_WRITE);
+	} else {
+		bulkResult(requestId, timeStart, job->load ? RESULT_LOADED : RESULT_DUMPED, job->accountsDone);
+	}
+	pthread_mutex_destroy(&job->mutex);
+	free(job->line);
+	free(job);
+}
@@ -0,0 +1,32 @@
+#include <sys/time.h>
+
+struct bulkJob;
+
+/*
+ * Bulk balance import and export
+ *   LOAD <file>                  set the balances listed in file
+ *   DUMP <file> [csv|binary]     write every balance to file, CSV if the name ends in .csv unless told otherwise
+ *
+ * CSV files have one "account,balance" line per account, lines that don't start with a number are skipped.
+ * Binary files are the 8 byte header "BANKBAL1" followed by runs of consecutive accounts, each one
+ * the first account, the number of accounts and then their balances, all 32 bit little-endian.
+ * A run starting at account 0 holds metadata instead of balances and is skipped by LOAD.
+ * A dump is written a chunk at a time by several workers, so its lines or runs are in no particular order.
+ *
+ * Each chunk of up to BULK_CHUNK accounts is read or written under the concurrency control strategy
+ * with a single storage call, so a TRANS sees all of a chunk loaded or none of it. Chunks are
+ * loaded in parallel, so an account listed twice in a file far enough apart may end up with either balance.
+ */
+
+//The server's number of workers, half of which may work on one LOAD or DUMP at the same time, over accounts 1 to count
+void bulkIoInit(int parallel, int count);
+
+//Put a 32 bit little-endian value at out
+void writeLE32(char *out, int value);
+
+//Start a LOAD or DUMP, its result is written when the last chunk is done
+void startLoad(int requestId, struct timeval timeStart, char *path);
+void startDump(int requestId, struct timeval timeStart, char *path, char *format);
+
+//Take one turn on a LOAD or DUMP, a chunk of work, and queue the next turn if there is more
+void processBulkJob(struct bulkJob *job, int requestId, struct timeval timeStart);
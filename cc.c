@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "cc.h"
+#include "sparse.h"
+
+ccStrategy *cc;
+int ccStripes = 256;
+
+//Nothing to do for a step of a strategy
+void ccNoInit(int numAccounts){
+}
+void ccNoBegin(int *accountNums, int n, unsigned *versions){
+}
+int ccAlwaysValid(int *accountNums, int n, unsigned *versions){
+	return 1;
+}
+void ccNoEnd(int *accountNums, int n, int wrote){
+}
+
+//global: one lock around every request, like the original coarse server
+pthread_mutex_t bankLock = PTHREAD_MUTEX_INITIALIZER;
+
+void globalBegin(int *accountNums, int n, unsigned *versions){
+	pthread_mutex_lock(&bankLock);
+}
+void globalEnd(int *accountNums, int n, int wrote){
+	pthread_mutex_unlock(&bankLock);
+}
+
+//2pl: two phase locking with a lock per account
+void twoPhaseBegin(int *accountNums, int n, unsigned *versions){
+	lockAccounts(accountNums, n);
+}
+void twoPhaseEnd(int *accountNums, int n, int wrote){
+	unlockAccounts(accountNums, n);
+}
+
+//striped: two phase locking on a fixed number of locks, account n uses lock (n-1) % stripes
+pthread_mutex_t *stripeLocks;
+
+void stripedInit(int numAccounts){
+	int i;
+	stripeLocks = malloc(ccStripes*sizeof(pthread_mutex_t));
+	for(i=0; i<ccStripes; i++){
+		pthread_mutex_init(&stripeLocks[i], NULL);
+	}
+}
+
+//Fill stripes with the sorted, duplicate free stripes of the accounts, returns how many there are
+int accountStripes(int *accountNums, int n, int *stripes){
+	int i;
+	for(i=0; i<n; i++){
+		stripes[i] = (accountNums[i]-1) % ccStripes + 1;
+	}
+	return sortAccounts(stripes, n);
+}
+
+void stripedBegin(int *accountNums, int n, unsigned *versions){
+	int small[64];
+	int *stripes = n <= 64 ? small : malloc(n*sizeof(int));
+	int i;
+	int count = accountStripes(accountNums, n, stripes);
+	for(i=0; i<count; i++){
+		pthread_mutex_lock(&stripeLocks[stripes[i]-1]);
+	}
+	if(stripes != small){
+		free(stripes);
+	}
+}
+void stripedEnd(int *accountNums, int n, int wrote){
+	int small[64];
+	int *stripes = n <= 64 ? small : malloc(n*sizeof(int));
+	int i;
+	int count = accountStripes(accountNums, n, stripes);
+	for(i=0; i<count; i++){
+		pthread_mutex_unlock(&stripeLocks[stripes[i]-1]);
+	}
+	if(stripes != small){
+		free(stripes);
+	}
+}
+
+//occ: read without locks, then lock only to check nothing changed and to write
+//An account's version changes, under its lock, every time it is written
+void optimisticBegin(int *accountNums, int n, unsigned *versions){
+	int i;
+	for(i=0; i<n; i++){
+		versions[i] = __atomic_load_n(&accountAt(accountNums[i])->version, __ATOMIC_ACQUIRE);
+	}
+}
+int optimisticValidate(int *accountNums, int n, unsigned *versions){
+	int i;
+	lockAccounts(accountNums, n);
+	for(i=0; i<n; i++){
+		if(accountAt(accountNums[i])->version != versions[i]){
+			unlockAccounts(accountNums, n);
+			return 0;
+		}
+	}
+	return 1;
+}
+void optimisticEnd(int *accountNums, int n, int wrote){
+	int i;
+	for(i=0; wrote && i<n; i++){
+		account *acc = accountAt(accountNums[i]);
+		__atomic_store_n(&acc->version, acc->version+1, __ATOMIC_RELEASE);
+	}
+	unlockAccounts(accountNums, n);
+}
+
+//fifo: a ticket lock per account, granted strictly in the order tickets were taken
+//A request takes its tickets on all of its accounts at once, so every account queues
+//requests in the same order and a big TRANS can't be overtaken by later small ones
+typedef struct fifoLock{
+	pthread_mutex_t mutex;
+	pthread_cond_t turn;
+	unsigned nextTicket;
+	unsigned serving;
+} fifoLock;
+
+fifoLock *fifoLocks;
+sparseArray *fifoPages = NULL;
+pthread_mutex_t ticketMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void initFifoLocks(void *page, int n){
+	fifoLock *locks = page;
+	int i;
+	for(i=0; i<n; i++){
+		pthread_mutex_init(&locks[i].mutex, NULL);
+		pthread_cond_init(&locks[i].turn, NULL);
+		locks[i].nextTicket = 0;
+		locks[i].serving = 0;
+	}
+}
+
+void fifoInit(int numAccounts){
+	//Sparse accounts get their ticket locks a page at a time too
+	if(accounts == NULL){
+		fifoPages = sparseNew(numAccounts, sizeof(fifoLock), initFifoLocks);
+		return;
+	}
+	fifoLocks = malloc(numAccounts*sizeof(fifoLock));
+	initFifoLocks(fifoLocks, numAccounts);
+}
+
+fifoLock * fifoAt(int accountNum){
+	return fifoPages ? sparseAt(fifoPages, accountNum-1) : &fifoLocks[accountNum-1];
+}
+
+void fifoTickets(int *accountNums, int n, unsigned *tickets){
+	int i;
+	pthread_mutex_lock(&ticketMutex);
+	for(i=0; i<n; i++){
+		tickets[i] = __atomic_fetch_add(&fifoAt(accountNums[i])->nextTicket, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&ticketMutex);
+}
+
+void fifoWait(int *accountNums, int n, unsigned *tickets){
+	int i;
+	for(i=0; i<n; i++){
+		fifoLock *lock = fifoAt(accountNums[i]);
+		if(__atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE) == tickets[i]){
+			continue;
+		}
+		pthread_mutex_lock(&lock->mutex);
+		while(lock->serving != tickets[i]){
+			pthread_cond_wait(&lock->turn, &lock->mutex);
+		}
+		pthread_mutex_unlock(&lock->mutex);
+	}
+}
+
+void fifoBegin(int *accountNums, int n, unsigned *versions){
+	fifoTickets(accountNums, n, versions);
+	fifoWait(accountNums, n, versions);
+}
+void fifoEnd(int *accountNums, int n, int wrote){
+	int i;
+	for(i=0; i<n; i++){
+		fifoLock *lock = fifoAt(accountNums[i]);
+		pthread_mutex_lock(&lock->mutex);
+		__atomic_store_n(&lock->serving, lock->serving+1, __ATOMIC_RELEASE);
+		//Only the next ticket can go, but every waiter has to look to find out which one it is
+		if(__atomic_load_n(&lock->nextTicket, __ATOMIC_RELAXED) != lock->serving){
+			pthread_cond_broadcast(&lock->turn);
+		}
+		pthread_mutex_unlock(&lock->mutex);
+	}
+}
+
+//serial: a single worker runs every request, so nothing needs a lock
+
+ccStrategy strategies[] = {
+	{"global", ccNoInit, globalBegin, ccAlwaysValid, globalEnd},
+	{"2pl", ccNoInit, twoPhaseBegin, ccAlwaysValid, twoPhaseEnd},
+	{"striped", stripedInit, stripedBegin, ccAlwaysValid, stripedEnd},
+	{"occ", ccNoInit, optimisticBegin, optimisticValidate, optimisticEnd},
+	{"fifo", fifoInit, fifoBegin, ccAlwaysValid, fifoEnd},
+	{"serial", ccNoInit, ccNoBegin, ccAlwaysValid, ccNoEnd},
+	{NULL}
+};
+
+ccStrategy * ccFind(char *name){
+	int i;
+	for(i=0; strategies[i].name; i++){
+		if(strcmp(strategies[i].name, name) == 0){
+			return &strategies[i];
+		}
+	}
+	return NULL;
+}
+
+void ccList(FILE *out){
+	int i;
+	for(i=0; strategies[i].name; i++){
+		fprintf(out, "%s%s", i ? ", " : "", strategies[i].name);
+	}
+}
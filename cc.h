@@ -0,0 +1,36 @@
+/*
+ * Concurrency control strategies
+ * Every request that reads or writes accounts runs
+ *     do { begin; read } while(!validate);  write; end;
+ * over the sorted, duplicate free list of its accounts.
+ * Pessimistic strategies lock in begin and always validate, optimistic ones
+ * remember versions in begin and lock and check them in validate.
+ */
+typedef struct ccStrategy{
+	char *name;
+	//Set up the strategy for the given number of accounts
+	void (*init)(int numAccounts);
+	//Start reading a set of accounts, versions has room for one entry per account
+	void (*begin)(int *accountNums, int n, unsigned *versions);
+	//Returns 1 when what was read since begin is still current and the accounts may be written, 0 to start over
+	int (*validate)(int *accountNums, int n, unsigned *versions);
+	//Finish with the accounts, wrote is set when they were written
+	void (*end)(int *accountNums, int n, int wrote);
+} ccStrategy;
+
+//The strategy every request uses
+extern ccStrategy *cc;
+
+//Find a strategy by name, returns NULL if there is none
+ccStrategy * ccFind(char *name);
+
+//Print the names of the strategies
+void ccList(FILE *out);
+
+//The two halves of the fifo strategy's begin, the tickets may be waited for on another thread
+//than the one that took them, and the accounts released by yet another one with cc->end
+void fifoTickets(int *accountNums, int n, unsigned *tickets);
+void fifoWait(int *accountNums, int n, unsigned *tickets);
+
+//Number of lock stripes for the striped strategy
+extern int ccStripes;
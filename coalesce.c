@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "cc.h"
+#include "coalesce.h"
+#include "probes.h"
+#include "results.h"
+#include "storage.h"
+#include "timing.h"
+
+#define FLIGHT_BUCKETS 256
+
+//A CHECK waiting for another CHECK's read
+typedef struct flightWaiter{
+	int requestId;
+	struct timeval timeStart;
+	struct flightWaiter *next;
+} flightWaiter;
+
+//A read of one account that other CHECKs may still join, its waiters are sorted by request ID
+typedef struct flight{
+	int accountNum;
+	int firstId;
+	flightWaiter *waiters;
+	struct flight *next;
+} flight;
+
+//Reads in flight, hashed by account, each bucket with its own lock
+typedef struct flightBucket{
+	pthread_mutex_t mutex;
+	flight *flights;
+} flightBucket;
+
+int coalesceOn = 0;
+flightBucket buckets[FLIGHT_BUCKETS];
+
+//Reads made, reads that served more than one CHECK, and CHECKs that joined a read
+long coalesceReads = 0;
+long sharedReads = 0;
+long joinedChecks = 0;
+
+void coalesceInit(){
+	int i;
+	coalesceOn = 1;
+	for(i=0; i<FLIGHT_BUCKETS; i++){
+		pthread_mutex_init(&buckets[i].mutex, NULL);
+		buckets[i].flights = NULL;
+	}
+}
+
+//Stop taking joiners, the waiters list doesn't change after this
+void land(flight *f){
+	flightBucket *bucket = &buckets[(unsigned) f->accountNum % FLIGHT_BUCKETS];
+	pthread_mutex_lock(&bucket->mutex);
+	flight **at = &bucket->flights;
+	while(*at != f){
+		at = &(*at)->next;
+	}
+	*at = f->next;
+	pthread_mutex_unlock(&bucket->mutex);
+}
+
+int coalesceCheck(int requestId, struct timeval timeStart, int accountNum){
+	if(!coalesceOn){
+		return 0;
+	}
+
+	//Join a read of the account that is already going
+	flightBucket *bucket = &buckets[(unsigned) accountNum % FLIGHT_BUCKETS];
+	pthread_mutex_lock(&bucket->mutex);
+	//With --ordered a read only takes CHECKs within a window of its lowest ID, the leader may have to wait to write the others
+	int window = resultsWindow();
+	flight *f;
+	for(f=bucket->flights; f!=NULL; f=f->next){
+		if(f->accountNum == accountNum && (window == 0 || requestId < f->firstId+window)){
+			flightWaiter *waiter = malloc(sizeof(flightWaiter));
+			waiter->requestId = requestId;
+			waiter->timeStart = timeStart;
+			//Keep the waiters in ID order, they nearly always go at the end
+			flightWaiter **at = &f->waiters;
+			while(*at && (*at)->requestId < requestId){
+				at = &(*at)->next;
+			}
+			waiter->next = *at;
+			*at = waiter;
+			if(requestId < f->firstId){
+				f->firstId = requestId;
+			}
+			pthread_mutex_unlock(&bucket->mutex);
+			__sync_fetch_and_add(&joinedChecks, 1);
+			return 1;
+		}
+	}
+	//Otherwise start one
+	flight self = {accountNum, requestId, NULL, bucket->flights};
+	bucket->flights = &self;
+	pthread_mutex_unlock(&bucket->mutex);
+
+	int balance;
+	unsigned version;
+	int landed = 0;
+	do{
+		BANK_PROBE4(lock_start, requestId, REQ_CHECK, 1, &accountNum);
+		cc->begin(&accountNum, 1, &version);
+		BANK_PROBE4(lock_end, requestId, REQ_CHECK, 1, &accountNum);
+		BANK_PROBE4(read, requestId, REQ_CHECK, 1, &accountNum);
+		storageReadAll(&accountNum, 1, &balance);
+		//Joining stops before an optimistic strategy validates, a locking one still holds the account here
+		if(!landed){
+			land(&self);
+			landed = 1;
+		}
+	} while(!cc->validate(&accountNum, 1, &version));
+	cc->end(&accountNum, 1, 0);
+	__sync_fetch_and_add(&coalesceReads, 1);
+
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+	char result[128];
+	int len;
+
+	//Every CHECK that joined gets the same balance under its own ID
+	//They are written in ID order with this one in its place, with --ordered the lowest one may be the head request
+	if(self.waiters){
+		__sync_fetch_and_add(&sharedReads, 1);
+	}
+	int written = 0;
+	while(self.waiters || !written){
+		if(!written && (!self.waiters || requestId < self.waiters->requestId)){
+			len = resultEncode(result, requestId, RESULT_BAL, balance, 0, timeStart, finished);
+			resultWrite(requestId, result, len, 1);
+			written = 1;
+			continue;
+		}
+		flightWaiter *waiter = self.waiters;
+		self.waiters = waiter->next;
+		len = resultEncode(result, waiter->requestId, RESULT_BAL, balance, 0, waiter->timeStart, finished);
+		resultWrite(waiter->requestId, result, len, 1);
+		free(waiter);
+	}
+	return 1;
+}
+
+void coalesceStats(FILE *out){
+	if(!coalesceOn){
+		return;
+	}
+	fprintf(out, "coalesced checks: %ld reads, %ld of them shared, %ld reads saved (%.1f%% of single account CHECKs)\n", coalesceReads, sharedReads, joinedChecks,
+		coalesceReads+joinedChecks ? 100.0*joinedChecks/(coalesceReads+joinedChecks) : 0.0);
+}
+
+void coalesceMetrics(FILE *out){
+	if(!coalesceOn){
+		return;
+	}
+	fprintf(out, "# HELP bank_check_reads_total Storage reads made for single account CHECKs.\n# TYPE bank_check_reads_total counter\n");
+	fprintf(out, "bank_check_reads_total %ld\n", __atomic_load_n(&coalesceReads, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_check_shared_reads_total Reads that answered more than one CHECK.\n# TYPE bank_check_shared_reads_total counter\n");
+	fprintf(out, "bank_check_shared_reads_total %ld\n", __atomic_load_n(&sharedReads, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_check_coalesced_total CHECKs answered by another CHECK's read, each one a read saved.\n# TYPE bank_check_coalesced_total counter\n");
+	fprintf(out, "bank_check_coalesced_total %ld\n", __atomic_load_n(&joinedChecks, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+/*
+ * Single-flight CHECKs
+ * With --coalesce-checks a single account CHECK that arrives while another CHECK of the same
+ * account is reading it doesn't read the account again. It joins that read, and the worker
+ * doing the read writes the joined CHECKs' results too, each under its own request ID. A CHECK
+ * can join only until the read has returned. Under a locking strategy the account is still
+ * held then, and an optimistic one validates after that, so every joined CHECK gets a balance
+ * that was current at some point after it arrived. The results go out in request ID order, and
+ * with --ordered a CHECK only joins a read less than a reorder window past its lowest ID.
+ */
+
+//Turn on coalescing
+void coalesceInit();
+
+//Run a single account CHECK, returns 0 if coalescing is off
+int coalesceCheck(int requestId, struct timeval timeStart, int accountNum);
+
+//Print how many reads were shared and how many were saved
+void coalesceStats(FILE *out);
+
+//Write the same counters as Prometheus text, nothing when coalescing is off
+void coalesceMetrics(FILE *out);
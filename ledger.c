@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "ledger.h"
+#include "results.h"
+#include "sparse.h"
+
+//One account's change in one TRANS, 32 bytes
+typedef struct ledgerEntry{
+	//Position of the account's previous entry plus one, 0 for its first
+	long prev;
+	unsigned long long committedNs;
+	int requestId;
+	int accountNum;
+	int delta;
+	int balance;
+} ledgerEntry;
+
+int ledgerOn = 0;
+int ledgerAccounts;
+sparseArray *entries;
+//Position of each account's newest entry plus one
+sparseArray *newest;
+long entryCount = 0;
+long droppedEntries = 0;
+
+void ledgerInit(int count){
+	ledgerOn = 1;
+	ledgerAccounts = count;
+	entries = sparseNew(LEDGER_MAX_ENTRIES, sizeof(ledgerEntry), NULL);
+	newest = sparseNew(count, sizeof(long), NULL);
+}
+
+void ledgerCommit(int requestId, int *ids, int *balances, int numIds, int *accountNums, int *amounts, int n){
+	int i;
+	if(!ledgerOn){
+		return;
+	}
+	int small[64];
+	int *deltas = numIds <= 64 ? small : malloc(numIds*sizeof(int));
+	memset(deltas, 0, numIds*sizeof(int));
+	for(i=0; i<n; i++){
+		deltas[accountIndex(ids, numIds, accountNums[i])] += amounts[i];
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	//Claim the positions for all of the entries at once, the accounts are held so nobody else moves their heads
+	long first = __sync_fetch_and_add(&entryCount, numIds);
+	if(first+numIds > LEDGER_MAX_ENTRIES){
+		__sync_fetch_and_add(&droppedEntries, numIds);
+		numIds = 0;
+	}
+	for(i=0; i<numIds; i++){
+		long *head = sparseAt(newest, ids[i]-1);
+		ledgerEntry *entry = sparseAt(entries, first+i);
+		entry->prev = *head;
+		entry->committedNs = (unsigned long long) now.tv_sec*1000000000ULL + now.tv_nsec;
+		entry->requestId = requestId;
+		entry->accountNum = ids[i];
+		entry->delta = deltas[i];
+		entry->balance = balances[i];
+		//A HISTORY may be reading the head, it has to see the whole entry once it sees the new position
+		__atomic_store_n(head, first+i+1, __ATOMIC_RELEASE);
+	}
+	if(deltas != small){
+		free(deltas);
+	}
+}
+
+void ledgerHistory(int requestId, struct timeval timeStart, int accountNum, int limit){
+	struct timeval finished;
+	char result[128];
+	int len;
+
+	if(!ledgerOn){
+		gettimeofday(&finished, NULL);
+		len = resultEncode(result, requestId, RESULT_ERROR, ERROR_NO_LEDGER, 0, timeStart, finished);
+		resultWrite(requestId, result, len, 1);
+		return;
+	}
+
+	//Walk the account's chain from its newest entry, only as far as the limit
+	//The entries never change, so the second walk sees the same ones as long as it starts at the same head
+	//Accounts that don't exist just have no entries
+	long *head = accountNum >= 1 && accountNum <= ledgerAccounts ? sparsePeek(newest, accountNum-1) : NULL;
+	long newestPosition = head ? __atomic_load_n(head, __ATOMIC_ACQUIRE) : 0;
+	long position = newestPosition;
+	int count = 0;
+	while(position > 0 && count < limit){
+		position = ((ledgerEntry*) sparsePeek(entries, position-1))->prev;
+		count++;
+	}
+
+	gettimeofday(&finished, NULL);
+	char *block = malloc(128 + (long) count*128);
+	len = resultEncode(block, requestId, RESULT_HISTORY, count, accountNum, timeStart, finished);
+	position = newestPosition;
+	int i;
+	for(i=0; i<count; i++){
+		ledgerEntry *entry = sparsePeek(entries, position-1);
+		struct timeval committed = {entry->committedNs/1000000000ULL, entry->committedNs%1000000000ULL/1000};
+		len += resultEncode(block+len, entry->requestId, RESULT_ENTRY, entry->delta, entry->balance, committed, committed);
+		position = entry->prev;
+	}
+	resultWrite(requestId, block, len, 1);
+	free(block);
+}
+
+void ledgerStats(FILE *out){
+	if(!ledgerOn){
+		return;
+	}
+	fprintf(out, "ledger: %ld entries, %ld dropped when full, %.1f MB\n", entryCount-droppedEntries, droppedEntries, (sparseBytes(entries)+sparseBytes(newest))/1048576.0);
+}
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+/*
+ * Account ledger
+ * With --ledger every committed TRANS appends one entry per account it changed: the request,
+ * the account's delta (repeated accounts in a TRANS are added up) and its balance afterwards.
+ * Entries are never changed once written. Each one points back at the previous entry of the same
+ * account and every account points at its newest, so HISTORY reads only the entries it returns.
+ * LOAD sets balances without a delta and isn't in the ledger.
+ *
+ *   HISTORY <acct> [limit]   the newest limit entries of the account (default 10), newest first
+ */
+
+//Most entries the ledger holds, after that TRANS stop being recorded
+#define LEDGER_MAX_ENTRIES (1L << 28)
+
+//Turn on the ledger for accounts 1 to count
+void ledgerInit(int count);
+
+//Record a committed TRANS, called with its accounts still held
+//ids and balances are its sorted accounts and their new balances, accountNums and amounts its pairs
+void ledgerCommit(int requestId, int *ids, int *balances, int numIds, int *accountNums, int *amounts, int n);
+
+//Write the result of a HISTORY request
+void ledgerHistory(int requestId, struct timeval timeStart, int accountNum, int limit);
+
+//Print how many entries the ledger holds and the memory they take
+void ledgerStats(FILE *out);
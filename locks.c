@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "sparse.h"
+
+//Each thread's lock profiling counters, linked together so a report can add them up
+typedef struct threadLockStats{
+	lockStats *stripes;
+	struct threadLockStats *next;
+} threadLockStats;
+
+account *accounts;
+sparseArray *accountPages = NULL;
+
+//Lock profiling, off when profileStripes is 0
+int profileStripes = 0;
+int profileAccounts;
+threadLockStats *allLockStats = NULL;
+pthread_mutex_t lockStatsMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread lockStats *myLockStats = NULL;
+
+//Counters are only written by their own thread, but a report may read them at any time
+#define STAT_ADD(field, amount) __atomic_store_n(&(field), (field)+(amount), __ATOMIC_RELAXED)
+#define STAT_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+//Set up the locks of a page of accounts, the rest of an account starts out zero
+void initAccountPage(void *page, int entries){
+	account *pageAccounts = page;
+	int i;
+	for(i=0; i<entries; i++){
+		pthread_mutex_init(&pageAccounts[i].lock, NULL);
+	}
+}
+
+//Allocate the accounts and their locks, or with sparse set only a table for pages of them
+void initAccounts(int n, int sparse){
+	int i;
+	if(sparse){
+		accounts = NULL;
+		accountPages = sparseNew(n, sizeof(account), initAccountPage);
+		return;
+	}
+	accounts = (account*) malloc(n*sizeof(account));
+	for(i=0; i<n; i++){
+		pthread_mutex_init(&(accounts[i].lock), NULL);
+		accounts[i].value = 0;
+		accounts[i].version = 0;
+	}
+}
+
+account * accountAt(int accountNum){
+	return accounts ? &accounts[accountNum-1] : sparseAt(accountPages, accountNum-1);
+}
+
+long accountBytes(){
+	return accountPages ? sparseBytes(accountPages) : 0;
+}
+
+//Compare two account numbers for qsort
+int compareAccounts(const void *a, const void *b){
+	return *(const int*)a - *(const int*)b;
+}
+
+//Sort a list of account numbers and drop the duplicates, returns the number left
+int sortAccounts(int *accountNums, int n){
+	int i;
+	int unique = 0;
+
+	qsort(accountNums, n, sizeof(int), compareAccounts);
+	for(i=0; i<n; i++){
+		if(unique == 0 || accountNums[unique-1] != accountNums[i]){
+			accountNums[unique] = accountNums[i];
+			unique++;
+		}
+	}
+	return unique;
+}
+
+//Current time on the monotonic clock in nanoseconds
+unsigned long long lockClock(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+//Find this thread's lock counters, the first call from a thread sets them up
+lockStats * threadStats(){
+	if(myLockStats == NULL){
+		threadLockStats *stats = malloc(sizeof(threadLockStats));
+		stats->stripes = calloc(profileStripes, sizeof(lockStats));
+		pthread_mutex_lock(&lockStatsMutex);
+		stats->next = allLockStats;
+		allLockStats = stats;
+		pthread_mutex_unlock(&lockStatsMutex);
+		myLockStats = stats->stripes;
+	}
+	return myLockStats;
+}
+
+//Lock one account and count how long it took, a lock that is free costs a single clock read
+void lockProfiled(int accountNum){
+	account *acc = accountAt(accountNum);
+	lockStats *stats = &threadStats()[(accountNum-1) % profileStripes];
+
+	if(pthread_mutex_trylock(&acc->lock) == 0){
+		acc->lockedAt = lockClock();
+	} else {
+		unsigned long long start = lockClock();
+		pthread_mutex_lock(&acc->lock);
+		acc->lockedAt = lockClock();
+		unsigned long long wait = acc->lockedAt-start;
+		STAT_ADD(stats->contended, 1);
+		STAT_ADD(stats->waitNs, wait);
+		if(wait > stats->maxWaitNs){
+			__atomic_store_n(&stats->maxWaitNs, wait, __ATOMIC_RELAXED);
+		}
+	}
+	STAT_ADD(stats->acquisitions, 1);
+}
+
+//Find an account in a sorted list, returns its index or -1
+int accountIndex(int *accountNums, int n, int accountNum){
+	int *found = bsearch(&accountNum, accountNums, n, sizeof(int), compareAccounts);
+	return found ? found-accountNums : -1;
+}
+
+//Lock a sorted list of accounts, always locking in increasing order means two requests can't deadlock
+void lockAccounts(int *accountNums, int n){
+	int i;
+	for(i=0; i<n; i++){
+		if(profileStripes){
+			lockProfiled(accountNums[i]);
+		} else {
+			pthread_mutex_lock(&accountAt(accountNums[i])->lock);
+		}
+	}
+}
+
+//Unlock accounts locked by lockAccounts
+void unlockAccounts(int *accountNums, int n){
+	int i;
+	unsigned long long now = profileStripes ? lockClock() : 0;
+	for(i=0; i<n; i++){
+		account *acc = accountAt(accountNums[i]);
+		if(profileStripes){
+			lockStats *stats = &threadStats()[(accountNums[i]-1) % profileStripes];
+			STAT_ADD(stats->holdNs, now-acc->lockedAt);
+		}
+		pthread_mutex_unlock(&acc->lock);
+	}
+}
+
+//Turn on lock profiling, accounts share counters when there are more accounts than stripes
+void lockProfileInit(int stripes, int numAccounts){
+	profileAccounts = numAccounts;
+	profileStripes = stripes < numAccounts ? stripes : numAccounts;
+}
+
+//Order stripes by their total wait time, most waited on first
+lockStats *reportTotals;
+int compareWait(const void *a, const void *b){
+	unsigned long long waitA = reportTotals[*(const int*)a].waitNs;
+	unsigned long long waitB = reportTotals[*(const int*)b].waitNs;
+	return (waitA < waitB) - (waitA > waitB);
+}
+
+//Lock totals as Prometheus text, the list of threads' counters is only locked when a new thread joins it
+void lockProfileMetrics(FILE *out){
+	if(!profileStripes){
+		return;
+	}
+	unsigned long long acquisitions = 0;
+	unsigned long long contended = 0;
+	unsigned long long waitNs = 0;
+	unsigned long long holdNs = 0;
+	int i;
+
+	pthread_mutex_lock(&lockStatsMutex);
+	threadLockStats *thread;
+	for(thread = allLockStats; thread; thread = thread->next){
+		for(i=0; i<profileStripes; i++){
+			acquisitions += STAT_READ(thread->stripes[i].acquisitions);
+			contended += STAT_READ(thread->stripes[i].contended);
+			waitNs += STAT_READ(thread->stripes[i].waitNs);
+			holdNs += STAT_READ(thread->stripes[i].holdNs);
+		}
+	}
+	pthread_mutex_unlock(&lockStatsMutex);
+
+	fprintf(out, "# HELP bank_lock_acquisitions_total Account locks taken.\n# TYPE bank_lock_acquisitions_total counter\n");
+	fprintf(out, "bank_lock_acquisitions_total %llu\n", acquisitions);
+	fprintf(out, "# HELP bank_lock_contended_total Account locks that had to be waited for.\n# TYPE bank_lock_contended_total counter\n");
+	fprintf(out, "bank_lock_contended_total %llu\n", contended);
+	fprintf(out, "# HELP bank_lock_wait_seconds_total Time spent waiting for account locks.\n# TYPE bank_lock_wait_seconds_total counter\n");
+	fprintf(out, "bank_lock_wait_seconds_total %.6f\n", waitNs/1e9);
+	fprintf(out, "# HELP bank_lock_hold_seconds_total Time account locks were held.\n# TYPE bank_lock_hold_seconds_total counter\n");
+	fprintf(out, "bank_lock_hold_seconds_total %.6f\n", holdNs/1e9);
+}
+
+//Add up every thread's counters and print the topN accounts or stripes that were waited on the most
+void lockProfileReport(FILE *out, int topN){
+	int i;
+	if(!profileStripes){
+		fprintf(out, "lock profiling is off, start the server with --lock-profile\n");
+		return;
+	}
+
+	lockStats *totals = calloc(profileStripes, sizeof(lockStats));
+	int *order = malloc(profileStripes*sizeof(int));
+	long acquisitions = 0;
+	long contended = 0;
+	unsigned long long waitNs = 0;
+
+	pthread_mutex_lock(&lockStatsMutex);
+	threadLockStats *thread;
+	for(thread = allLockStats; thread; thread = thread->next){
+		for(i=0; i<profileStripes; i++){
+			lockStats *stats = &thread->stripes[i];
+			unsigned long long maxWait = STAT_READ(stats->maxWaitNs);
+			totals[i].acquisitions += STAT_READ(stats->acquisitions);
+			totals[i].contended += STAT_READ(stats->contended);
+			totals[i].waitNs += STAT_READ(stats->waitNs);
+			totals[i].holdNs += STAT_READ(stats->holdNs);
+			if(maxWait > totals[i].maxWaitNs){
+				totals[i].maxWaitNs = maxWait;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lockStatsMutex);
+
+	for(i=0; i<profileStripes; i++){
+		order[i] = i;
+		acquisitions += totals[i].acquisitions;
+		contended += totals[i].contended;
+		waitNs += totals[i].waitNs;
+	}
+	reportTotals = totals;
+	qsort(order, profileStripes, sizeof(int), compareWait);
+
+	fprintf(out, "lock profile: %ld acquisitions, %ld contended, %.3f ms total wait\n", acquisitions, contended, waitNs/1e6);
+	fprintf(out, "%-10s %12s %10s %14s %14s %14s %14s\n", profileStripes == profileAccounts ? "account" : "stripe",
+		"acquisitions", "contended", "wait total ms", "wait avg us", "wait max us", "hold total ms");
+	for(i=0; i<topN && i<profileStripes; i++){
+		lockStats *stats = &totals[order[i]];
+		if(stats->acquisitions == 0){
+			break;
+		}
+		fprintf(out, "%-10d %12ld %10ld %14.3f %14.3f %14.3f %14.3f\n", order[i]+1, stats->acquisitions, stats->contended,
+			stats->waitNs/1e6, stats->waitNs/1e3/stats->acquisitions, stats->maxWaitNs/1e3, stats->holdNs/1e6);
+	}
+	free(totals);
+	free(order);
+}
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "appserver.h"
+#include "cc.h"
+#include "coalesce.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "replica.h"
+#include "results.h"
+#include "timing.h"
+
+unsigned long long monotonicNs();
+
+//This is the function the metrics thread runs
+void * serveMetrics(void *arg);
+
+int metricsListener;
+unsigned long long metricsStarted;
+
+//The strategy the timed one passes every step on to
+ccStrategy *untimed;
+ccStrategy timed;
+
+//Waiting in begin and validate is waiting for locks, for the optimistic strategies too
+void timedBegin(int *accountNums, int n, unsigned *versions){
+	int previous = timingEnter(STATE_LOCK);
+	untimed->begin(accountNums, n, versions);
+	timingLeave(previous);
+}
+
+int timedValidate(int *accountNums, int n, unsigned *versions){
+	int previous = timingEnter(STATE_LOCK);
+	int valid = untimed->validate(accountNums, n, versions);
+	timingLeave(previous);
+	return valid;
+}
+
+void metricsListen(char *path){
+	struct sockaddr_un addr;
+
+	metricsListener = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+	if(metricsListener < 0 || bind(metricsListener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(metricsListener, 16) != 0){
+		perror(path);
+		exit(1);
+	}
+
+	//A client that hangs up early shows up as a write error instead of killing the server
+	signal(SIGPIPE, SIG_IGN);
+
+	metricsStarted = monotonicNs();
+	timingInit();
+	//Time the concurrency control steps by wrapping the strategy
+	untimed = cc;
+	timed = *cc;
+	timed.begin = timedBegin;
+	timed.validate = timedValidate;
+	cc = &timed;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, serveMetrics, NULL);
+	pthread_detach(thread);
+}
+
+void * serveMetrics(void *arg){
+	while(1){
+		int fd = accept(metricsListener, NULL, NULL);
+		if(fd < 0){
+			continue;
+		}
+
+		//Give an HTTP client a moment to send its request, a plain client sends nothing
+		char request[1024];
+		int http = 0;
+		struct pollfd wait = {fd, POLLIN, 0};
+		if(poll(&wait, 1, 50) == 1){
+			int len = read(fd, request, sizeof(request)-1);
+			http = len >= 4 && strncmp(request, "GET ", 4) == 0;
+		}
+
+		//Build the whole response first so an HTTP client gets its length
+		char *text = NULL;
+		size_t size = 0;
+		FILE *out = open_memstream(&text, &size);
+		fprintf(out, "# HELP bank_uptime_seconds Time since the server started.\n# TYPE bank_uptime_seconds gauge\n");
+		fprintf(out, "bank_uptime_seconds %.3f\n", (monotonicNs() - metricsStarted)/1e9);
+		timingMetrics(out);
+		queueMetrics(out);
+		pipelineMetrics(out);
+		coalesceMetrics(out);
+		resultsMetrics(out);
+		lockProfileMetrics(out);
+		replicationMetrics(out);
+		fclose(out);
+
+		FILE *conn = fdopen(fd, "w");
+		if(http){
+			fprintf(conn, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", size);
+		}
+		fwrite(text, 1, size, conn);
+		fclose(conn);
+		free(text);
+	}
+	return NULL;
+}
@@ -0,0 +1,10 @@
+/*
+ * Live metrics
+ * With --metrics=PATH the server listens on a Unix socket and answers every connection with
+ * its metrics as Prometheus text, then closes it. A client that starts with an HTTP request,
+ * like curl --unix-socket PATH http://localhost/metrics, gets an HTTP response around it.
+ * Nothing here takes a lock the workers hold while serving a request.
+ */
+
+//Turn on worker time accounting and start answering metrics requests on a Unix socket at path
+void metricsListen(char *path);
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+//Count the spaces in a request, a request with n spaces has at most n+1 parts
+int countSpaces(char *line){
+	int j;
+	int spaces =0;
+	int length = strlen(line);
+	for(j =0; j<length; j++){
+		if(line[j] == ' '){
+			spaces++;
+		}
+	}
+	return spaces;
+}
+
+//Cut the request up in place into individual array indexes
+//command needs room for spaces+2 entries and always ends with a NULL, returns the number of parts
+int splitCommand(char *line, char **command, int spaces){
+	int j;
+	//Initialize the entire array to be null to start
+	for(j =0; j<spaces+2; j++){
+		command[j] = NULL;
+	}
+
+	int i = 0;
+	char *save;
+	char * cut = strtok_r(line, " ", &save);
+	while(cut != NULL){
+		command[i] = cut;
+		cut = strtok_r(NULL, " ", &save);
+		i++;
+	}
+	return i;
+}
+
+//Read the account and amount pairs of a TRANS out of its parts, returns the number of pairs
+int parseTrans(char **command, int parts, int *accountNums, int *amounts){
+	int numOfTrans = (parts-1)/2;
+	int i;
+	//Odd indexes should be the account num, and even should be the ammounts
+	for(i=0; i<numOfTrans; i++){
+		accountNums[i] = atoi(command[2*i+1]);
+		amounts[i] = atoi(command[2*i+2]);
+	}
+	return numOfTrans;
+}
+
+//Each thread's room to split and parse requests into, a request of any size fits without using the stack
+__thread char **partsRoom = NULL;
+__thread int partsRoomSize = 0;
+__thread int *intsRoom = NULL;
+__thread long intsRoomSize = 0;
+
+char ** commandRoom(int parts){
+	if(parts > partsRoomSize){
+		partsRoomSize = parts > 2*partsRoomSize ? parts : 2*partsRoomSize;
+		partsRoom = realloc(partsRoom, partsRoomSize*sizeof(char*));
+	}
+	return partsRoom;
+}
+
+int * pairsRoom(int n, int count){
+	long size = (long) n*count;
+	if(size > intsRoomSize){
+		intsRoomSize = size > 2*intsRoomSize ? size : 2*intsRoomSize;
+		intsRoom = realloc(intsRoom, intsRoomSize*sizeof(int));
+	}
+	return intsRoom;
+}
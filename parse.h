@@ -0,0 +1,15 @@
+//Count the spaces in a request, a request with n spaces has at most n+1 parts
+int countSpaces(char *line);
+
+//Cut the request up in place into individual array indexes
+//command needs room for spaces+2 entries and always ends with a NULL, returns the number of parts
+int splitCommand(char *line, char **command, int spaces);
+
+//Read the account and amount pairs of a TRANS out of its parts, returns the number of pairs
+int parseTrans(char **command, int parts, int *accountNums, int *amounts);
+
+//Room for a request split into parts entries, each thread keeps its own and grows it for larger requests
+char ** commandRoom(int parts);
+
+//Room for count arrays of n ints one after another, kept by each thread the same way
+int * pairsRoom(int n, int count);
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "appserver.h"
+#include "parse.h"
+#include "storage.h"
+#include "partition.h"
+
+//This is the function each router connection's thread runs
+void * serveConnection(void *arg);
+
+//First account of this partition minus one, global account n is local account n-partitionBase
+int partitionBase;
+int partitionCount;
+
+//A transaction's accounts in local numbering, locked and read
+typedef struct staged{
+	int n;
+	int *ids;
+	int *balances;
+} staged;
+
+void servePartition(char *path, int base, int count){
+	struct sockaddr_un addr;
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	partitionBase = base;
+	partitionCount = count;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+	if(listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 64) != 0){
+		perror(path);
+		exit(1);
+	}
+
+	while(1){
+		long conn = accept(listener, NULL, NULL);
+		if(conn < 0){
+			continue;
+		}
+		pthread_t thread;
+		pthread_create(&thread, NULL, serveConnection, (void*) conn);
+		pthread_detach(thread);
+	}
+}
+
+//Lock and read the local accounts of a list of account and amount pairs and apply the amounts
+//Returns 0 with the accounts locked and the new balances staged, or the first account that would go below zero with nothing locked
+int stageTrans(char **command, int parts, staged *txn){
+	int pairs = (parts-1)/2;
+	int *accountNums = pairsRoom(pairs+1, 2);
+	int *amounts = accountNums+pairs+1;
+	int i;
+
+	parseTrans(command, parts, accountNums, amounts);
+	for(i=0; i<pairs; i++){
+		accountNums[i] -= partitionBase;
+	}
+	txn->ids = realloc(txn->ids, (pairs+1)*sizeof(int));
+	txn->balances = realloc(txn->balances, (pairs+1)*sizeof(int));
+	memcpy(txn->ids, accountNums, pairs*sizeof(int));
+	txn->n = sortAccounts(txn->ids, pairs);
+
+	lockAccounts(txn->ids, txn->n);
+	storageReadAll(txn->ids, txn->n, txn->balances);
+	for(i=0; i<pairs; i++){
+		int k = accountIndex(txn->ids, txn->n, accountNums[i]);
+		if(txn->balances[k]+amounts[i] < 0){
+			unlockAccounts(txn->ids, txn->n);
+			txn->n = 0;
+			return accountNums[i]+partitionBase;
+		}
+		txn->balances[k] += amounts[i];
+	}
+	return 0;
+}
+
+//Write the staged balances and release the accounts
+void commitTrans(staged *txn){
+	storageWriteAll(txn->ids, txn->n, txn->balances);
+	unlockAccounts(txn->ids, txn->n);
+	txn->n = 0;
+}
+
+void * serveConnection(void *arg){
+	int conn = (long) arg;
+	FILE *in = fdopen(conn, "r");
+	FILE *out = fdopen(dup(conn), "w");
+	char *line = NULL;
+	size_t size = 0;
+	staged txn = {0, NULL, NULL};
+	int j;
+
+	while(getline(&line, &size, in) != -1){
+		line[strcspn(line, "\n")] = '\0';
+		int spaces = countSpaces(line);
+		//A READ carries all of a bulk check's accounts on this partition, so the parts go on the heap
+		char **command = commandRoom(spaces+2);
+		int parts = splitCommand(line, command, spaces);
+
+		if(parts == 0){
+			fprintf(out, "\n");
+		}
+		else if(strcmp(command[0], "CHECK") == 0 && parts == 2){
+			int accountNum = atoi(command[1])-partitionBase;
+			lockAccounts(&accountNum, 1);
+			int balance = read_account(accountNum);
+			unlockAccounts(&accountNum, 1);
+			fprintf(out, "BAL %d\n", balance);
+		}
+		else if(strcmp(command[0], "READ") == 0){
+			int *ids = pairsRoom(parts, 2);
+			int *values = ids+parts;
+			for(j=1; j<parts; j++){
+				ids[j-1] = atoi(command[j])-partitionBase;
+			}
+			//The router sends the accounts sorted, so they lock in the usual order
+			lockAccounts(ids, parts-1);
+			read_accounts(ids, parts-1, values);
+			unlockAccounts(ids, parts-1);
+			fprintf(out, "VALUES");
+			for(j=0; j<parts-1; j++){
+				fprintf(out, " %d", values[j]);
+			}
+			fprintf(out, "\n");
+		}
+		else if(strcmp(command[0], "TRANS") == 0){
+			int isf = stageTrans(command, parts, &txn);
+			if(isf){
+				fprintf(out, "ISF %d\n", isf);
+			} else {
+				commitTrans(&txn);
+				fprintf(out, "OK\n");
+			}
+		}
+		else if(strcmp(command[0], "PREPARE") == 0){
+			int isf = stageTrans(command, parts, &txn);
+			if(isf){
+				fprintf(out, "NO %d\n", isf);
+			} else {
+				fprintf(out, "YES\n");
+			}
+		}
+		else if(strcmp(command[0], "COMMIT") == 0){
+			commitTrans(&txn);
+			fprintf(out, "DONE\n");
+		}
+		else if(strcmp(command[0], "ABORT") == 0){
+			unlockAccounts(txn.ids, txn.n);
+			txn.n = 0;
+			fprintf(out, "DONE\n");
+		}
+		else if(strcmp(command[0], "END") == 0){
+			exit(0);
+		}
+		else{
+			fprintf(out, "ERROR\n");
+		}
+		fflush(out);
+	}
+
+	//A router that goes away in the middle of a two phase commit gives up its accounts
+	unlockAccounts(txn.ids, txn.n);
+	free(txn.ids);
+	free(txn.balances);
+	free(line);
+	fclose(in);
+	fclose(out);
+	return NULL;
+}
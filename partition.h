@@ -0,0 +1,17 @@
+/*
+ * Partition mode
+ * A partitioned server owns accounts base+1 to base+count and takes requests from a router
+ * over a Unix socket instead of stdin. Each router connection is served by its own thread,
+ * one request at a time, and every request gets a one line reply. Accounts are global IDs.
+ *
+ *   CHECK <acct>                       -> BAL <balance>
+ *   READ <acct> <acct> ...             -> VALUES <balance> <balance> ...   (accounts sorted, no duplicates)
+ *   TRANS <acct> <amount> ...          -> OK | ISF <acct>
+ *   PREPARE <acct> <amount> ...        -> YES | NO <acct>   (YES keeps the accounts locked)
+ *   COMMIT                             -> DONE              (writes what the last PREPARE staged)
+ *   ABORT                              -> DONE
+ *   END                                   ends the partition server
+ */
+
+//Accept router connections on a Unix socket at path and serve them until a router sends END
+void servePartition(char *path, int base, int count);
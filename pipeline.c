@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "cc.h"
+#include "ledger.h"
+#include "pipeline.h"
+#include "probes.h"
+#include "replica.h"
+#include "results.h"
+#include "snapshot.h"
+#include "storage.h"
+#include "timing.h"
+
+unsigned long long monotonicNs();
+
+//A CHECK or TRANS on its way through the stages, the arrays are allocated along with it
+typedef struct stageJob{
+	int requestId;
+	struct timeval timeStart;
+	int check;
+	int n;
+	int numLocks;
+	int *accountNums;
+	int *amounts;
+	int *lockOrder;
+	int *balances;
+	unsigned *versions;
+	//The result, filled in by the storage stage
+	int type;
+	int value;
+	struct timeval finished;
+	//Requests whose balances aren't written yet, for snapshots
+	struct stageJob *prev;
+	struct stageJob *next;
+} stageJob;
+
+//A stage, the bounded queue in front of it and the threads that work it
+typedef struct stage{
+	char *name;
+	void (*run)(stageJob *job);
+	struct stage *next;
+	stageJob **jobs;
+	int size;
+	int head;
+	int depth;
+	int closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	int threads;
+	pthread_t *workers;
+	//Statistics, the counters are shared by the stage's threads
+	int maxDepth;
+	long processed;
+	long fullStalls;
+	unsigned long long busyNs;
+} stage;
+
+//What each stage does with a request
+void stagePush(stage *st, stageJob *job);
+void runCc(stageJob *job);
+void runStorage(stageJob *job);
+void runOutput(stageJob *job);
+
+//This is the function each stage thread runs
+void * stageThread(void *arg);
+
+stage stages[] = {
+	{"cc", runCc},
+	{"storage", runStorage},
+	{"output", runOutput},
+};
+#define NUM_STAGES 3
+
+int pipelineOn = 0;
+unsigned long long pipelineStarted;
+stageJob *inFlight = NULL;
+//Time the calling thread has spent waiting for room in a full queue, which isn't busy time
+__thread unsigned long long fullWaitNs = 0;
+pthread_mutex_t inFlightMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void pipelineInit(int ccThreads, int storageThreads, int outputThreads, int depth){
+	int threads[NUM_STAGES] = {ccThreads, storageThreads, outputThreads};
+	int i, j;
+	pipelineOn = 1;
+	pipelineStarted = monotonicNs();
+	for(i=0; i<NUM_STAGES; i++){
+		stage *st = &stages[i];
+		//The cc stage queues its requests for storage itself
+		st->next = i > 0 && i+1 < NUM_STAGES ? &stages[i+1] : NULL;
+		st->size = depth;
+		st->jobs = malloc(depth*sizeof(stageJob*));
+		pthread_mutex_init(&st->mutex, NULL);
+		pthread_cond_init(&st->notEmpty, NULL);
+		pthread_cond_init(&st->notFull, NULL);
+		st->threads = threads[i];
+		st->workers = malloc(threads[i]*sizeof(pthread_t));
+		for(j=0; j<threads[i]; j++){
+			pthread_create(&st->workers[j], NULL, stageThread, st);
+		}
+	}
+}
+
+//Queue a request for a stage, waiting for room when its queue is full
+void stagePush(stage *st, stageJob *job){
+	pthread_mutex_lock(&st->mutex);
+	if(st->depth == st->size){
+		unsigned long long start = monotonicNs();
+		st->fullStalls++;
+		while(st->depth == st->size){
+			pthread_cond_wait(&st->notFull, &st->mutex);
+		}
+		fullWaitNs += monotonicNs()-start;
+	}
+	st->jobs[(st->head+st->depth) % st->size] = job;
+	st->depth++;
+	if(st->depth > st->maxDepth){
+		st->maxDepth = st->depth;
+	}
+	pthread_cond_signal(&st->notEmpty);
+	pthread_mutex_unlock(&st->mutex);
+}
+
+void * stageThread(void *arg){
+	stage *st = arg;
+	timingWorker();
+	while(1){
+		timingSet(STATE_IDLE);
+		pthread_mutex_lock(&st->mutex);
+		while(st->depth == 0 && !st->closed){
+			pthread_cond_wait(&st->notEmpty, &st->mutex);
+		}
+		if(st->depth == 0){
+			pthread_mutex_unlock(&st->mutex);
+			break;
+		}
+		stageJob *job = st->jobs[st->head];
+		st->head = (st->head+1) % st->size;
+		st->depth--;
+		pthread_cond_signal(&st->notFull);
+		pthread_mutex_unlock(&st->mutex);
+
+		timingSet(STATE_OTHER);
+		unsigned long long start = monotonicNs();
+		fullWaitNs = 0;
+		st->run(job);
+		__sync_fetch_and_add(&st->busyNs, monotonicNs()-start-fullWaitNs);
+		__sync_fetch_and_add(&st->processed, 1);
+		if(st->next){
+			stagePush(st->next, job);
+		}
+	}
+	return NULL;
+}
+
+//Make a request and queue it for the first stage, it counts as unwritten from here on
+stageJob * newJob(int requestId, struct timeval timeStart, int n){
+	stageJob *job = malloc(sizeof(stageJob) + 4*n*sizeof(int) + n*sizeof(unsigned));
+	job->requestId = requestId;
+	job->timeStart = timeStart;
+	job->n = n;
+	job->accountNums = (int*) (job+1);
+	job->amounts = job->accountNums+n;
+	job->lockOrder = job->amounts+n;
+	job->balances = job->lockOrder+n;
+	job->versions = (unsigned*) (job->balances+n);
+	return job;
+}
+
+void startJob(stageJob *job){
+	pthread_mutex_lock(&inFlightMutex);
+	job->prev = NULL;
+	job->next = inFlight;
+	if(inFlight){
+		inFlight->prev = job;
+	}
+	inFlight = job;
+	pthread_mutex_unlock(&inFlightMutex);
+	stagePush(&stages[0], job);
+}
+
+int pipelineCheck(int requestId, struct timeval timeStart, int accountNum){
+	if(!pipelineOn){
+		return 0;
+	}
+	stageJob *job = newJob(requestId, timeStart, 1);
+	job->check = 1;
+	job->accountNums[0] = accountNum;
+	job->lockOrder[0] = accountNum;
+	job->numLocks = 1;
+	startJob(job);
+	return 1;
+}
+
+int pipelineTrans(int requestId, struct timeval timeStart, int *accountNums, int *amounts, int n){
+	if(!pipelineOn){
+		return 0;
+	}
+	stageJob *job = newJob(requestId, timeStart, n);
+	job->check = 0;
+	memcpy(job->accountNums, accountNums, n*sizeof(int));
+	memcpy(job->amounts, amounts, n*sizeof(int));
+	memcpy(job->lockOrder, accountNums, n*sizeof(int));
+	job->numLocks = sortAccounts(job->lockOrder, n);
+	startJob(job);
+	return 1;
+}
+
+int pipelineOldest(){
+	int oldest = 0;
+	stageJob *job;
+	pthread_mutex_lock(&inFlightMutex);
+	for(job=inFlight; job!=NULL; job=job->next){
+		if(oldest == 0 || job->requestId < oldest){
+			oldest = job->requestId;
+		}
+	}
+	pthread_mutex_unlock(&inFlightMutex);
+	return oldest;
+}
+
+//Only the tickets are taken here, so the stage never waits on a lock. They are taken and the request
+//queued for storage in one step, so storage gets requests in ticket order and its oldest one can always go
+pthread_mutex_t ticketOrder = PTHREAD_MUTEX_INITIALIZER;
+
+void runCc(stageJob *job){
+	//Waiting behind a thread that is waiting for room in the storage queue isn't busy time either
+	unsigned long long start = monotonicNs();
+	pthread_mutex_lock(&ticketOrder);
+	fullWaitNs += monotonicNs()-start;
+	fifoTickets(job->lockOrder, job->numLocks, job->versions);
+	stagePush(&stages[1], job);
+	pthread_mutex_unlock(&ticketOrder);
+}
+
+//The wait for the accounts happens here with the I/O, a ticket lock doesn't care which thread releases it
+void runStorage(stageJob *job){
+	int i;
+	int opcode = job->check ? REQ_CHECK : REQ_TRANS;
+	int previous = timingEnter(STATE_LOCK);
+	BANK_PROBE4(lock_start, job->requestId, opcode, job->numLocks, job->lockOrder);
+	fifoWait(job->lockOrder, job->numLocks, job->versions);
+	BANK_PROBE4(lock_end, job->requestId, opcode, job->numLocks, job->lockOrder);
+	timingLeave(previous);
+	BANK_PROBE4(read, job->requestId, opcode, job->numLocks, job->lockOrder);
+	storageReadAll(job->lockOrder, job->numLocks, job->balances);
+	if(job->check){
+		cc->end(job->lockOrder, job->numLocks, 0);
+		job->type = RESULT_BAL;
+		job->value = job->balances[0];
+	} else {
+		int ISF = 0;
+		for(i=0; i<job->n; i++){
+			int k = accountIndex(job->lockOrder, job->numLocks, job->accountNums[i]);
+			if(job->balances[k] + job->amounts[i] < 0){
+				ISF = 1;
+				break;
+			}
+			job->balances[k] += job->amounts[i];
+		}
+		BANK_PROBE4(isf, job->requestId, job->n, ISF, ISF ? job->accountNums[i] : 0);
+		if(ISF){
+			job->type = RESULT_ISF;
+			job->value = job->accountNums[i];
+		} else {
+			//The reads were made with the accounts held, so only the writes need to keep a snapshot out
+			//Every writer takes the snapshot lock after its accounts, never before: a storage thread waiting here
+			//holds tickets a LOAD chunk may be waiting on, and that chunk must not hold the lock the snapshot wants
+			snapshotWriteBegin();
+			BANK_PROBE3(write, job->requestId, job->numLocks, job->lockOrder);
+			storageWriteAll(job->lockOrder, job->numLocks, job->balances);
+			replicateCommit(job->lockOrder, job->numLocks, job->balances);
+			ledgerCommit(job->requestId, job->lockOrder, job->balances, job->numLocks, job->accountNums, job->amounts, job->n);
+			snapshotWriteEnd();
+			job->type = RESULT_OK;
+			job->value = 0;
+		}
+		cc->end(job->lockOrder, job->numLocks, !ISF);
+		timingTrans(ISF);
+	}
+	gettimeofday(&job->finished, NULL);
+
+	pthread_mutex_lock(&inFlightMutex);
+	if(job->prev){
+		job->prev->next = job->next;
+	} else {
+		inFlight = job->next;
+	}
+	if(job->next){
+		job->next->prev = job->prev;
+	}
+	pthread_mutex_unlock(&inFlightMutex);
+}
+
+void runOutput(stageJob *job){
+	char result[128];
+	int len = resultEncode(result, job->requestId, job->type, job->value, 0, job->timeStart, job->finished);
+	//The head request may be in a queue behind this one, so the output stage never waits for the window
+	resultPost(job->requestId, result, len);
+	free(job);
+}
+
+void pipelineClose(){
+	int i, j;
+	if(!pipelineOn){
+		return;
+	}
+	//Each stage finishes its queue before the next one is told no more is coming
+	for(i=0; i<NUM_STAGES; i++){
+		stage *st = &stages[i];
+		pthread_mutex_lock(&st->mutex);
+		st->closed = 1;
+		pthread_cond_broadcast(&st->notEmpty);
+		pthread_mutex_unlock(&st->mutex);
+		for(j=0; j<st->threads; j++){
+			pthread_join(st->workers[j], NULL);
+		}
+	}
+
+	double elapsed = (monotonicNs() - pipelineStarted)/1e9;
+	for(i=0; i<NUM_STAGES; i++){
+		stage *st = &stages[i];
+		fprintf(stderr, "stage %s: %d threads, %ld requests, max queue depth %d of %d, %ld full queue stalls, %.1f%% busy\n",
+			st->name, st->threads, st->processed, st->maxDepth, st->size, st->fullStalls, elapsed > 0 ? 100*st->busyNs/1e9/elapsed/st->threads : 0);
+		free(st->jobs);
+		free(st->workers);
+	}
+}
+
+//Read without the stage locks, the numbers may be a moment out of date
+void pipelineMetrics(FILE *out){
+	int i;
+	if(!pipelineOn){
+		return;
+	}
+	fprintf(out, "# HELP bank_stage_threads Threads working each pipeline stage.\n# TYPE bank_stage_threads gauge\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_threads{stage=\"%s\"} %d\n", stages[i].name, stages[i].threads);
+	}
+	fprintf(out, "# HELP bank_stage_queue_depth Requests waiting in front of each pipeline stage.\n# TYPE bank_stage_queue_depth gauge\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_queue_depth{stage=\"%s\"} %d\n", stages[i].name, __atomic_load_n(&stages[i].depth, __ATOMIC_RELAXED));
+	}
+	fprintf(out, "# HELP bank_stage_queue_max_depth Most requests ever waiting in front of each pipeline stage.\n# TYPE bank_stage_queue_max_depth gauge\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_queue_max_depth{stage=\"%s\"} %d\n", stages[i].name, __atomic_load_n(&stages[i].maxDepth, __ATOMIC_RELAXED));
+	}
+	fprintf(out, "# HELP bank_stage_requests_total Requests each pipeline stage has finished.\n# TYPE bank_stage_requests_total counter\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_requests_total{stage=\"%s\"} %ld\n", stages[i].name, __atomic_load_n(&stages[i].processed, __ATOMIC_RELAXED));
+	}
+	fprintf(out, "# HELP bank_stage_full_stalls_total Times a request waited for room in front of a pipeline stage.\n# TYPE bank_stage_full_stalls_total counter\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_full_stalls_total{stage=\"%s\"} %ld\n", stages[i].name, __atomic_load_n(&stages[i].fullStalls, __ATOMIC_RELAXED));
+	}
+	fprintf(out, "# HELP bank_stage_busy_seconds_total Time each pipeline stage's threads spent on requests.\n# TYPE bank_stage_busy_seconds_total counter\n");
+	for(i=0; i<NUM_STAGES; i++){
+		fprintf(out, "bank_stage_busy_seconds_total{stage=\"%s\"} %.6f\n", stages[i].name, __atomic_load_n(&stages[i].busyNs, __ATOMIC_RELAXED)/1e9);
+	}
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+/*
+ * Staged pipeline
+ * With --pipeline the workers only parse. A single account CHECK or a TRANS then moves through
+ * three more stages, each with its own threads and a bounded queue in front of it:
+ *
+ *   cc        takes the request's fifo tickets on its accounts, without waiting for them
+ *   storage   waits for its turn on the accounts, reads the balances, decides OK or ISF,
+ *             writes them under the snapshot lock, taken only now that it holds the accounts
+ *             like every other writer, and releases the accounts
+ *   output    encodes the result and hands it to the result writer, without waiting for room
+ *             in the reorder buffer, the head request may be in a queue behind it
+ *
+ * Accounts are released by a different thread than the one that locked them, so the pipeline
+ * always uses the fifo ticket locks. Every other kind of request is still run by the worker that parsed it.
+ */
+
+//Start the stages with the given number of threads each and queues holding up to depth requests
+void pipelineInit(int ccThreads, int storageThreads, int outputThreads, int depth);
+
+//Hand a parsed request to the pipeline, returns 0 if there is no pipeline
+int pipelineCheck(int requestId, struct timeval timeStart, int accountNum);
+int pipelineTrans(int requestId, struct timeval timeStart, int *accountNums, int *amounts, int n);
+
+//Lowest request ID still in the pipeline without its balances written, 0 if none
+int pipelineOldest();
+
+//Let the stages finish what they hold and stop them, then print each stage's statistics
+void pipelineClose();
+
+//Write each stage's queue depth and throughput as Prometheus text, nothing without a pipeline
+void pipelineMetrics(FILE *out);
@@ -0,0 +1,37 @@
+/*
+ * Static tracepoints
+ * USDT probes in the "bank" provider for perf and bpftrace, built in when <sys/sdt.h> is there
+ * (systemtap-sdt-dev / systemtap-sdt-devel) and no code otherwise. A probe that nobody is
+ * tracing is a single nop, and its arguments are values the code already has at hand.
+ *
+ *   enqueue(id, command)                 a request was queued, command is its text
+ *   dequeue(id)                          a worker took it off the queue
+ *   lock_start(id, opcode, n, ids)       it starts waiting for its n accounts, ids is the sorted int array
+ *   lock_end(id, opcode, n, ids)         it holds them
+ *   read(id, opcode, n, ids)             the Bank reads of its accounts start
+ *   write(id, n, ids)                    the Bank writes of a TRANS start
+ *   isf(id, pairs, isf, account)         a TRANS was decided, account is the one short of money or 0
+ *   result(id, len, last)                a result of len bytes was handed to the writer
+ *
+ * opcode is the REQ_ kind from timing.h. The bpftrace scripts in bench (.bt) use them.
+ */
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BANK_PROBES 1
+#endif
+#endif
+
+#ifdef BANK_PROBES
+#define BANK_PROBE1(name, a) DTRACE_PROBE1(bank, name, a)
+#define BANK_PROBE2(name, a, b) DTRACE_PROBE2(bank, name, a, b)
+#define BANK_PROBE3(name, a, b, c) DTRACE_PROBE3(bank, name, a, b, c)
+#define BANK_PROBE4(name, a, b, c, d) DTRACE_PROBE4(bank, name, a, b, c, d)
+#else
+//The arguments are still evaluated and thrown away, so a variable kept only for a probe isn't unused
+#define BANK_PROBE1(name, a) do{ (void) (a); } while(0)
+#define BANK_PROBE2(name, a, b) do{ (void) (a); (void) (b); } while(0)
+#define BANK_PROBE3(name, a, b, c) do{ (void) (a); (void) (b); (void) (c); } while(0)
+#define BANK_PROBE4(name, a, b, c, d) do{ (void) (a); (void) (b); (void) (c); (void) (d); } while(0)
+#endif
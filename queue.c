@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "appserver.h"
+#include "results.h"
+
+queue *q;
+pthread_mutex_t queueMutex;
+pthread_cond_t queueNotEmpty;
+pthread_cond_t queueNotFull;
+int maxQueueDepth = 0;
+
+//Queue counters, rejected is only changed under the queue lock, expired is changed by the workers
+int maxSeenDepth = 0;
+long rejectedRequests = 0;
+long expiredRequests = 0;
+//The newest request put in the queue
+int lastPushedId = 0;
+
+//Initialize the queue with NULL values and 0 items, a maxDepth of 0 leaves it unbounded
+void queueInit(int maxDepth){
+	q = (queue*) malloc(sizeof(queue));
+	q->front = NULL;
+	q->rear = NULL;
+	q->count =0;
+	maxQueueDepth = maxDepth;
+	pthread_mutex_init(&queueMutex, NULL);
+	pthread_cond_init(&queueNotEmpty, NULL);
+	pthread_cond_init(&queueNotFull, NULL);
+}
+
+//Admission control for a new request, the queue lock must be held
+//When the queue is full either wait for the workers to make room or turn the request away
+//Returns 1 if the request can be pushed and 0 if it was rejected
+int queueAdmit(int blockWhenFull){
+	if(maxQueueDepth <= 0 || q->count < maxQueueDepth){
+		return 1;
+	}
+	if(!blockWhenFull){
+		rejectedRequests++;
+		return 0;
+	}
+	while(q->count >= maxQueueDepth){
+		pthread_cond_wait(&queueNotFull, &queueMutex);
+	}
+	return 1;
+}
+
+//This is a function to display the contents of the queue, used for testing early in the project
+void display(request *head){
+	if(head == NULL){
+		printf("NULL\n");
+	} else {
+		printf("%s\n", head->command);
+		display(head->next);
+	}
+}
+
+//Add new requests to the end of the queue, a deadline of 0 means the request never expires
+void push(char *cmd, int requestId, struct timeval deadline){
+	struct timeval timeStart;
+	gettimeofday(&timeStart, NULL);
+	pushStarted(cmd, requestId, timeStart, deadline);
+}
+
+//Add a request that arrived earlier somewhere else, like a CHECK routed to a replica
+void pushStarted(char *cmd, int requestId, struct timeval timeStart, struct timeval deadline){
+	request *toAdd = malloc(sizeof(request));
+	
+	toAdd->command = strdup(cmd);
+	toAdd->requestId = requestId;
+	toAdd->timeStart = timeStart;
+	toAdd->deadline = deadline;
+	if(requestId > lastPushedId){
+		lastPushedId = requestId;
+	}
+	toAdd->bulk = NULL;
+	toAdd->job = NULL;
+	toAdd->next = NULL;
+
+	if(q->count > 0){
+		q->rear->next = toAdd;
+		q->rear = toAdd;
+		q->count = q->count+1;
+	} else {
+		q->front = toAdd;
+		q->rear = toAdd;
+		q->count = 1;
+	}
+	if(q->count > maxSeenDepth){
+		maxSeenDepth = q->count;
+	}
+}
+
+//Add the chunks of a bulk check to the front of the queue, they belong to a request that was already dequeued
+//They skip admission control, a worker waiting for room in the queue could otherwise wait on itself
+void pushChunks(bulkCheck *bulk, int requestId, struct timeval timeStart){
+	request *first = NULL;
+	request *last = NULL;
+	int start;
+
+	for(start=0; start<bulk->count; start+=BULK_CHUNK){
+		request *toAdd = malloc(sizeof(request));
+		toAdd->command = NULL;
+		toAdd->requestId = requestId;
+		toAdd->timeStart = timeStart;
+		toAdd->deadline.tv_sec = 0;
+		toAdd->deadline.tv_usec = 0;
+		toAdd->bulk = bulk;
+		toAdd->job = NULL;
+		toAdd->chunkStart = start;
+		toAdd->chunkLen = bulk->count-start < BULK_CHUNK ? bulk->count-start : BULK_CHUNK;
+		toAdd->next = NULL;
+
+		if(last){
+			last->next = toAdd;
+		} else {
+			first = toAdd;
+		}
+		last = toAdd;
+		q->count = q->count+1;
+	}
+
+	last->next = q->front;
+	q->front = first;
+	if(!q->rear){
+		q->rear = last;
+	}
+}
+
+//Add a turn of a LOAD or DUMP to the queue, a job never has more turns than half the workers
+//Without --ordered it goes to the back, so the rest of the traffic gets served between its chunks
+//With --ordered it goes to the front like bulk check chunks, otherwise the workers could all be waiting
+//on the job's ID while its turn sits behind them
+//Like bulk check chunks they skip admission control
+void pushJob(struct bulkJob *job, int requestId, struct timeval timeStart){
+	request *toAdd = malloc(sizeof(request));
+	toAdd->command = NULL;
+	toAdd->requestId = requestId;
+	toAdd->timeStart = timeStart;
+	toAdd->deadline.tv_sec = 0;
+	toAdd->deadline.tv_usec = 0;
+	toAdd->bulk = NULL;
+	toAdd->job = job;
+	toAdd->next = NULL;
+
+	if(q->count == 0){
+		q->front = toAdd;
+		q->rear = toAdd;
+	} else if(resultsWindow() > 0){
+		toAdd->next = q->front;
+		q->front = toAdd;
+	} else {
+		q->rear->next = toAdd;
+		q->rear = toAdd;
+	}
+	q->count = q->count+1;
+}
+
+//Take every request no worker has started out of the queue, in order, for a hot restart
+//Chunks of bulk checks and turns of LOAD and DUMP stay, they belong to requests already started
+request * queueDetach(int *count){
+	request *first = NULL;
+	request *last = NULL;
+	request **at = &q->front;
+	*count = 0;
+	q->rear = NULL;
+	while(*at){
+		request *item = *at;
+		if(item->command){
+			*at = item->next;
+			item->next = NULL;
+			if(last){
+				last->next = item;
+			} else {
+				first = item;
+			}
+			last = item;
+			q->count--;
+			(*count)++;
+		} else {
+			q->rear = item;
+			at = &item->next;
+		}
+	}
+	return first;
+}
+
+//Remove requests from the front of the queue and slide all the other requests forward
+request pop(){
+	request *temp;
+	request toPop;
+
+	if(q->count >0){
+		toPop.requestId = q->front->requestId;
+		toPop.timeStart = q->front->timeStart;
+		toPop.deadline = q->front->deadline;
+		toPop.bulk = q->front->bulk;
+		toPop.chunkStart = q->front->chunkStart;
+		toPop.chunkLen = q->front->chunkLen;
+		toPop.job = q->front->job;
+		//The popped request owns the command from here on
+		toPop.command = q->front->command;
+		toPop.next = NULL;
+
+		temp = q->front;
+		q->front = q->front->next;
+		free(temp);
+		
+		if(!q->front){
+			q->rear = NULL;
+		}
+
+		q->count = q->count -1;
+		pthread_cond_signal(&queueNotFull);
+	} else {
+		toPop.command = NULL;
+	}
+
+	return toPop;
+}
+
+//Print the queue counters
+void queueStats(){
+	fprintf(stderr, "queue: max depth %d (limit %d), %ld rejected, %ld expired\n", maxSeenDepth, maxQueueDepth, rejectedRequests, expiredRequests);
+}
+
+//The same numbers plus the current depth as Prometheus text, read without taking the queue lock
+void queueMetrics(FILE *out){
+	fprintf(out, "# HELP bank_queue_depth Requests waiting in the queue.\n# TYPE bank_queue_depth gauge\n");
+	fprintf(out, "bank_queue_depth %d\n", __atomic_load_n(&q->count, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_queue_max_depth Most requests ever waiting in the queue.\n# TYPE bank_queue_max_depth gauge\n");
+	fprintf(out, "bank_queue_max_depth %d\n", __atomic_load_n(&maxSeenDepth, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_queue_limit Most requests the queue admits, 0 for unbounded.\n# TYPE bank_queue_limit gauge\n");
+	fprintf(out, "bank_queue_limit %d\n", maxQueueDepth);
+	fprintf(out, "# HELP bank_requests_rejected_total Requests turned away with BUSY.\n# TYPE bank_requests_rejected_total counter\n");
+	fprintf(out, "bank_requests_rejected_total %ld\n", __atomic_load_n(&rejectedRequests, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_requests_expired_total Requests dropped with TIMEOUT.\n# TYPE bank_requests_expired_total counter\n");
+	fprintf(out, "bank_requests_expired_total %ld\n", __atomic_load_n(&expiredRequests, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,205 @@
+/**
+* Replays a workload trace recorded with the server's --trace option
+* against a bank server, then reports the throughput and latency it got.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <float.h>
+#include "trace.h"
+
+/* Helper functions */
+void printUsage();
+void sleepUntil(unsigned long long target);
+int comparator(const void*, const void*);
+double percentile(double*, int, double);
+void analyzeOutputFile(double);
+
+unsigned long long monotonicNs();
+
+/* replay parameters */
+char trace_path[200], program_path[200], output_path[200], server_options[300] = "";
+double speed = 1;
+double rate = 0;
+int num_workers = 10;
+int num_accounts = 1000;
+
+int main(int argc, char** argv) {
+
+	if (argc < 4) {
+		printUsage();
+		return 0;
+	}
+
+	/* Initialize replay parameters */
+	strcpy(trace_path, argv[1]);
+	if (strcmp(argv[2], "max") == 0)
+		speed = 0;
+	else if (strstr(argv[2], "/s"))
+		rate = atof(argv[2]);
+	else
+		speed = atof(argv[2]);
+	strcpy(program_path, argv[3]);
+	if (argc > 4)
+		num_workers = atoi(argv[4]);
+	if (argc > 5)
+		num_accounts = atoi(argv[5]);
+	if (argc > 6)
+		strcpy(server_options, argv[6]);
+	sprintf(output_path, "replay_%d_%d.txt", num_workers, num_accounts);
+
+	FILE *trace = traceOpen(trace_path);
+	if (trace == NULL) {
+		printf("Error: %s is not a trace file.\n", trace_path);
+		return 1;
+	}
+
+	// delete the output file from previous replays
+	remove(output_path);
+
+	// the server's prompts are not needed, only its output file
+	char command[1000];
+	sprintf(command, "%s %d %d %s %s > /dev/null", program_path, num_workers, num_accounts, output_path, server_options);
+	FILE *pipe = popen(command, "w");
+	if (pipe == NULL) {
+		printf("Error: popen(%s) failed.\n", command);
+		return 1;
+	}
+
+	// send every line at its recorded offset divided by the speed, or as fast as possible
+	traceRecord rec = {0};
+	int num_sent = 0;
+	int sent_end = 0;
+	unsigned long long start = monotonicNs();
+	unsigned long long target = start;
+	unsigned long long max_behind = 0;
+	while (traceNext(trace, &rec)) {
+		if (speed > 0 || rate > 0) {
+			if (rate > 0)
+				target = start + num_sent * 1e9 / rate;
+			else
+				target += rec.delta / speed;
+			unsigned long long now = monotonicNs();
+			if (now < target) {
+				// make sure the earlier lines went out before waiting
+				fflush(pipe);
+				sleepUntil(target);
+			}
+			else if (now - target > max_behind)
+				max_behind = now - target;
+		}
+		fprintf(pipe, "%s\n", rec.line);
+		if (strcmp(rec.line, "END") == 0) {
+			sent_end = 1;
+			break;
+		}
+		num_sent++;
+	}
+	if (!sent_end)
+		fprintf(pipe, "END\n");
+	fflush(pipe);
+	double send_time = (monotonicNs() - start) / 1e9;
+	fclose(trace);
+
+	printf("Waiting for program to END...\n");
+	pclose(pipe);
+
+	printf("============== Replay Summary =================\n");
+	printf("\nBank program parameters: %d worker threads, %d bank accounts\n", num_workers, num_accounts);
+	printf("Trace: %s, speed %s\n", trace_path, speed > 0 || rate > 0 ? argv[2] : "max");
+	if (server_options[0])
+		printf("Server options: %s\n", server_options);
+	printf("Sent %d requests in %.3f seconds (%.1f requests per second)\n", num_sent, send_time, send_time > 0 ? num_sent / send_time : 0);
+	if (speed > 0 || rate > 0)
+		printf("Fell at most %.3f ms behind the trace's schedule\n", max_behind / 1e6);
+
+	analyzeOutputFile(send_time);
+	return 0;
+}
+
+void analyzeOutputFile(double send_time) {
+	FILE *out = fopen(output_path, "r");
+	if (out == NULL) {
+		printf("\n[Error] Cannot open output file %s\n", output_path);
+		return;
+	}
+
+	int size = 1024, count = 0;
+	double *latencies = (double*) malloc(size * sizeof(double));
+	double first_start = DBL_MAX, last_end = 0;
+	char *line = NULL;
+	size_t len = 0;
+
+	// every result has TIME <start> <end>, the account lines inside a bulk block do not
+	while (getline(&line, &len, out) != -1) {
+		char *time = strstr(line, " TIME ");
+		double start, end;
+		if (time == NULL || sscanf(time, " TIME %lf %lf", &start, &end) != 2)
+			continue;
+		if (count == size) {
+			size *= 2;
+			latencies = (double*) realloc(latencies, size * sizeof(double));
+		}
+		latencies[count++] = end - start;
+		if (start < first_start)
+			first_start = start;
+		if (end > last_end)
+			last_end = end;
+	}
+	fclose(out);
+	free(line);
+
+	if (count == 0) {
+		printf("\nNo results in %s\n", output_path);
+		free(latencies);
+		return;
+	}
+
+	qsort(latencies, count, sizeof(double), comparator);
+	printf("\n-- Throughput --\n");
+	printf("%d results between the first start and the last finish, %.3f seconds: %.1f requests per second\n",
+		count, last_end - first_start, count / (last_end - first_start));
+	printf("\n-- Latency (ms) --\n");
+	printf("p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n\n",
+		percentile(latencies, count, 50) * 1000, percentile(latencies, count, 90) * 1000,
+		percentile(latencies, count, 99) * 1000, percentile(latencies, count, 99.9) * 1000,
+		latencies[count - 1] * 1000);
+	free(latencies);
+}
+
+// nearest rank percentile of a sorted array
+double percentile(double *sorted, int count, double p) {
+	int rank = (int) (p / 100 * count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+	return sorted[rank - 1];
+}
+
+int comparator(const void *a, const void *b) {
+	double d1 = *(double*)a;
+	double d2 = *(double*)b;
+	return (d1 > d2) - (d1 < d2);
+}
+
+void sleepUntil(unsigned long long target) {
+	struct timespec ts;
+	ts.tv_sec = target / 1000000000ULL;
+	ts.tv_nsec = target % 1000000000ULL;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+void printUsage() {
+	printf("Usage: ./replay [trace_path] [speed] [program_path] [num_workers] [num_accounts] [server_options]\n");
+	printf("Parameter:\n");
+	printf("  %-14s: %s\n", "trace_path", "trace recorded by the bank server with --trace");
+	printf("  %-14s: %s\n", "speed", "1 replays at the recorded pace, N replays N times faster, N/s sends N requests per second, max sends as fast as possible");
+	printf("  %-14s: %s\n", "program_path", "path to the bank server program");
+	printf("  %-14s: %s\n", "num_workers", "optional paramter (default 10). Number of worker threads for the bank server");
+	printf("  %-14s: %s\n", "num_accounts", "optional paramter (default 1000). Number of bank accounts for the bank server");
+	printf("  %-14s: %s\n", "server_options", "optional parameter. Options passed on to the bank server, quoted as one argument");
+	printf("\nThe requests are sent to the server's stdin and the results are read back from replay_<workers>_<accounts>.txt\n");
+}
@@ -0,0 +1,551 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "appserver.h"
+#include "cc.h"
+#include "results.h"
+#include "replica.h"
+
+unsigned long long monotonicNs();
+
+//Accounts per snapshot line
+#define SNAPSHOT_CHUNK 512
+//Bytes a replica may fall behind its stream, past its initial snapshot, before it is dropped
+#define REPLICA_BACKLOG (64L << 20)
+
+//A CHECK sent to a replica and not answered yet
+typedef struct routedCheck{
+	int requestId;
+	int accountNum;
+	struct timeval timeStart;
+	unsigned long long sentAt;
+	struct routedCheck *next;
+} routedCheck;
+
+//One connected replica, as seen by the primary
+//Records go into its own buffer and its sender thread writes them out, so a slow replica only holds up itself
+typedef struct replicaConn{
+	int fd;
+	FILE *in;
+	routedCheck *pending;
+	struct replicaConn *next;
+	//The outgoing stream, guarded by mutex
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;
+	char *buf;
+	long len;
+	long size;
+	long behind;
+	long limit;
+	int dropped;
+	int closing;
+	pthread_t sender;
+} replicaConn;
+
+//These are the functions the primary's threads run
+void * acceptReplicas(void *arg);
+void * readAnswers(void *arg);
+void * sendRecords(void *arg);
+void queueRecord(replicaConn *conn, const char *text, int len);
+
+//Number of accounts on both sides
+int replicaAccounts;
+
+//Primary side state, the replica list and the streams are only touched under replicasMutex
+int replicating = 0;
+int routingChecks = 0;
+int replicaListener;
+replicaConn *replicas = NULL;
+int numReplicas = 0;
+unsigned roundRobin = 0;
+pthread_mutex_t replicasMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t checksAnswered = PTHREAD_COND_INITIALIZER;
+long outstandingChecks = 0;
+
+//Primary side stats
+long commitRecords = 0;
+long routedChecks = 0;
+long answeredChecks = 0;
+long localFallbacks = 0;
+long droppedReplicas = 0;
+double totalStaleness = 0;
+double maxStaleness = 0;
+
+//Replica side state and stats
+FILE *primaryIn;
+int following = 0;
+long appliedRecords = 0;
+double totalLag = 0;
+double maxLag = 0;
+long servedChecks = 0;
+unsigned long long firstCheck = 0;
+unsigned long long lastCheck = 0;
+
+void replicationListen(char *path, int count, int routeChecks){
+	struct sockaddr_un addr;
+
+	replicaAccounts = count;
+
+	replicaListener = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+	if(replicaListener < 0 || bind(replicaListener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(replicaListener, 16) != 0){
+		perror(path);
+		exit(1);
+	}
+	//A replica that goes away shows up as a write error instead of killing the primary
+	signal(SIGPIPE, SIG_IGN);
+
+	replicating = 1;
+	routingChecks = routeChecks;
+	pthread_t thread;
+	pthread_create(&thread, NULL, acceptReplicas, NULL);
+	pthread_detach(thread);
+}
+
+//Take replica connections for as long as the primary runs
+void * acceptReplicas(void *arg){
+	while(1){
+		int fd = accept(replicaListener, NULL, NULL);
+		if(fd < 0){
+			continue;
+		}
+		replicaConn *conn = calloc(1, sizeof(replicaConn));
+		conn->fd = fd;
+		conn->in = fdopen(dup(fd), "r");
+		pthread_mutex_init(&conn->mutex, NULL);
+		pthread_cond_init(&conn->ready, NULL);
+		//No limit while the snapshot goes in, it is as big as the accounts
+		conn->limit = -1;
+
+		//Commits wait while the snapshot is taken, so each one is either in the snapshot or sent after it
+		//It only goes into the buffer here, the sender writes it out after
+		pthread_mutex_lock(&replicasMutex);
+		int values[SNAPSHOT_CHUNK];
+		char line[32 + SNAPSHOT_CHUNK*12];
+		int first, j;
+		for(first=0; first<replicaAccounts; first+=SNAPSHOT_CHUNK){
+			int n = replicaAccounts-first < SNAPSHOT_CHUNK ? replicaAccounts-first : SNAPSHOT_CHUNK;
+			//Sparse accounts that were never written are 0 on the replica already
+			if(!copy_values(first+1, n, values)){
+				continue;
+			}
+			int len = sprintf(line, "S %d", first+1);
+			for(j=0; j<n; j++){
+				len += sprintf(line+len, " %d", values[j]);
+			}
+			line[len++] = '\n';
+			queueRecord(conn, line, len);
+		}
+		queueRecord(conn, "SYNCED\n", 7);
+		conn->limit = conn->behind + REPLICA_BACKLOG;
+		conn->next = replicas;
+		replicas = conn;
+		numReplicas++;
+		pthread_mutex_unlock(&replicasMutex);
+
+		pthread_create(&conn->sender, NULL, sendRecords, conn);
+		pthread_t thread;
+		pthread_create(&thread, NULL, readAnswers, conn);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+//Add text to a replica's stream without waiting on its socket, called with replicasMutex held
+//so every replica gets the records in the same order. A replica too far behind is dropped instead.
+void queueRecord(replicaConn *conn, const char *text, int len){
+	pthread_mutex_lock(&conn->mutex);
+	if(!conn->dropped && conn->limit >= 0 && conn->behind+len > conn->limit){
+		//Its answer thread sees the connection end and answers the checks it still owed here
+		conn->dropped = 1;
+		droppedReplicas++;
+		shutdown(conn->fd, SHUT_RDWR);
+		fprintf(stderr, "replication: dropped a replica %ld bytes behind\n", conn->behind);
+	}
+	if(!conn->dropped){
+		if(conn->len+len > conn->size){
+			conn->size = conn->len+len > 2*conn->size ? conn->len+len : 2*conn->size;
+			conn->buf = realloc(conn->buf, conn->size);
+		}
+		memcpy(conn->buf+conn->len, text, len);
+		conn->len += len;
+		conn->behind += len;
+		pthread_cond_signal(&conn->ready);
+	}
+	pthread_mutex_unlock(&conn->mutex);
+}
+
+//Write a replica's stream out as it fills, and end it once the primary is done
+void * sendRecords(void *arg){
+	replicaConn *conn = arg;
+	pthread_mutex_lock(&conn->mutex);
+	while(1){
+		while(conn->len == 0 && !conn->closing && !conn->dropped){
+			pthread_cond_wait(&conn->ready, &conn->mutex);
+		}
+		if(conn->dropped){
+			break;
+		}
+		if(conn->len == 0){
+			shutdown(conn->fd, SHUT_WR);
+			break;
+		}
+		//Take the whole buffer, records keep going into a new one while this one is written
+		char *buf = conn->buf;
+		long len = conn->len;
+		conn->buf = NULL;
+		conn->len = 0;
+		conn->size = 0;
+		pthread_mutex_unlock(&conn->mutex);
+
+		long done = 0;
+		while(done < len){
+			ssize_t wrote = write(conn->fd, buf+done, len-done);
+			if(wrote <= 0){
+				break;
+			}
+			done += wrote;
+		}
+		free(buf);
+
+		pthread_mutex_lock(&conn->mutex);
+		conn->behind -= len;
+		if(done < len && !conn->dropped){
+			//The replica went away, its answer thread cleans up
+			conn->dropped = 1;
+			shutdown(conn->fd, SHUT_RDWR);
+		}
+	}
+	pthread_mutex_unlock(&conn->mutex);
+	return NULL;
+}
+
+void replicateCommit(int *ids, int n, int *balances){
+	if(!replicating){
+		return;
+	}
+	unsigned long long now = monotonicNs();
+	int j;
+
+	//The record is made once, outside the lock, and only copied to each replica's buffer under it
+	char small[512];
+	char *record = 48+n*24 <= (int) sizeof(small) ? small : malloc(48+n*24);
+	int len = sprintf(record, "C %llu %d", now, n);
+	for(j=0; j<n; j++){
+		len += sprintf(record+len, " %d %d", ids[j], balances[j]);
+	}
+	record[len++] = '\n';
+
+	pthread_mutex_lock(&replicasMutex);
+	commitRecords++;
+	replicaConn *conn;
+	for(conn=replicas; conn!=NULL; conn=conn->next){
+		queueRecord(conn, record, len);
+	}
+	pthread_mutex_unlock(&replicasMutex);
+	if(record != small){
+		free(record);
+	}
+}
+
+int routeCheck(int requestId, struct timeval timeStart, int accountNum){
+	if(!routingChecks || accountNum < 1 || accountNum > replicaAccounts){
+		return 0;
+	}
+
+	pthread_mutex_lock(&replicasMutex);
+	if(numReplicas == 0){
+		pthread_mutex_unlock(&replicasMutex);
+		return 0;
+	}
+	//Spread the checks round robin over the replicas
+	replicaConn *conn = replicas;
+	int k;
+	for(k=roundRobin++ % numReplicas; k>0; k--){
+		conn = conn->next;
+	}
+
+	routedCheck *check = malloc(sizeof(routedCheck));
+	check->requestId = requestId;
+	check->accountNum = accountNum;
+	check->timeStart = timeStart;
+	check->sentAt = monotonicNs();
+	check->next = conn->pending;
+	conn->pending = check;
+	char line[128];
+	int len = sprintf(line, "Q %d %ld %ld %llu %d\n", requestId, (long) timeStart.tv_sec, (long) timeStart.tv_usec, check->sentAt, accountNum);
+	queueRecord(conn, line, len);
+	routedChecks++;
+	outstandingChecks++;
+	pthread_mutex_unlock(&replicasMutex);
+	return 1;
+}
+
+//Answer a check the primary's own way, for checks whose replica went away
+void checkLocally(routedCheck *check){
+	int balance;
+	unsigned version;
+	do{
+		cc->begin(&check->accountNum, 1, &version);
+		balance = read_account(check->accountNum);
+	} while(!cc->validate(&check->accountNum, 1, &version));
+	cc->end(&check->accountNum, 1, 0);
+
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+	char result[128];
+	int len = resultEncode(result, check->requestId, RESULT_BAL, balance, 0, check->timeStart, finished);
+	resultPost(check->requestId, result, len);
+}
+
+//Pass a replica's answers on to the results as they come back
+void * readAnswers(void *arg){
+	replicaConn *conn = arg;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	while((len = getline(&line, &size, conn->in)) > 0){
+		int requestId = atoi(line);
+		unsigned long long now = monotonicNs();
+
+		pthread_mutex_lock(&replicasMutex);
+		routedCheck **prev = &conn->pending;
+		while(*prev != NULL && (*prev)->requestId != requestId){
+			prev = &(*prev)->next;
+		}
+		routedCheck *check = *prev;
+		if(check == NULL){
+			pthread_mutex_unlock(&replicasMutex);
+			continue;
+		}
+		*prev = check->next;
+		//The answer has every commit acknowledged before the check was routed, so this is how old it can be
+		double staleness = (now - check->sentAt)/1e9;
+		totalStaleness += staleness;
+		if(staleness > maxStaleness){
+			maxStaleness = staleness;
+		}
+		answeredChecks++;
+		pthread_mutex_unlock(&replicasMutex);
+
+		//The replica always answers in text, put it in this server's output format
+		int balance = 0;
+		long startSec, startUsec, finishSec, finishUsec;
+		sscanf(line, "%*d BAL %d TIME %ld.%ld %ld.%ld", &balance, &startSec, &startUsec, &finishSec, &finishUsec);
+		struct timeval started = {startSec, startUsec};
+		struct timeval finished = {finishSec, finishUsec};
+		char result[128];
+		//Later answers and commit acks queue up behind this thread, so it never waits for the reorder window
+		resultPost(requestId, result, resultEncode(result, requestId, RESULT_BAL, balance, 0, started, finished));
+		free(check);
+
+		pthread_mutex_lock(&replicasMutex);
+		outstandingChecks--;
+		if(outstandingChecks == 0){
+			pthread_cond_broadcast(&checksAnswered);
+		}
+		pthread_mutex_unlock(&replicasMutex);
+	}
+	free(line);
+
+	//The replica is gone, stop sending to it and answer what it still owed here
+	pthread_mutex_lock(&replicasMutex);
+	replicaConn **prev = &replicas;
+	while(*prev != NULL && *prev != conn){
+		prev = &(*prev)->next;
+	}
+	if(*prev != NULL){
+		*prev = conn->next;
+		numReplicas--;
+	}
+	routedCheck *owed = conn->pending;
+	conn->pending = NULL;
+	pthread_mutex_unlock(&replicasMutex);
+
+	while(owed != NULL){
+		routedCheck *next = owed->next;
+		checkLocally(owed);
+		free(owed);
+		pthread_mutex_lock(&replicasMutex);
+		localFallbacks++;
+		outstandingChecks--;
+		if(outstandingChecks == 0){
+			pthread_cond_broadcast(&checksAnswered);
+		}
+		pthread_mutex_unlock(&replicasMutex);
+		owed = next;
+	}
+	//The sender is done once the stream is ended or dropped
+	pthread_mutex_lock(&conn->mutex);
+	if(!conn->closing && !conn->dropped){
+		conn->dropped = 1;
+		shutdown(conn->fd, SHUT_RDWR);
+	}
+	pthread_cond_signal(&conn->ready);
+	pthread_mutex_unlock(&conn->mutex);
+	pthread_join(conn->sender, NULL);
+	fclose(conn->in);
+	close(conn->fd);
+	free(conn->buf);
+	free(conn);
+	return NULL;
+}
+
+void replicationClose(){
+	if(!replicating){
+		return;
+	}
+
+	pthread_mutex_lock(&replicasMutex);
+	while(outstandingChecks > 0){
+		pthread_cond_wait(&checksAnswered, &replicasMutex);
+	}
+	//Ending the streams tells the replicas to finish up, their senders write out what is left first
+	//and their answer threads clean up the connections
+	replicaConn *conn;
+	for(conn=replicas; conn!=NULL; conn=conn->next){
+		pthread_mutex_lock(&conn->mutex);
+		conn->closing = 1;
+		pthread_cond_signal(&conn->ready);
+		pthread_mutex_unlock(&conn->mutex);
+	}
+	fprintf(stderr, "replication: %d replicas, %ld commit records, %ld checks routed, %ld answered by a replica, %ld answered locally, %ld replicas dropped\n", numReplicas, commitRecords, routedChecks, answeredChecks, localFallbacks, droppedReplicas);
+	if(answeredChecks > 0){
+		fprintf(stderr, "replica checks: staleness bound avg %.3f ms, max %.3f ms\n", totalStaleness/answeredChecks*1000, maxStaleness*1000);
+	}
+	pthread_mutex_unlock(&replicasMutex);
+}
+
+FILE * replicaConnect(char *path){
+	struct sockaddr_un addr;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	if(fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0){
+		perror(path);
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	primaryIn = fdopen(dup(fd), "r");
+	FILE *out = fdopen(fd, "w");
+	//Every result line is an answer the primary is waiting on
+	setvbuf(out, NULL, _IOLBF, 0);
+	return out;
+}
+
+void replicaFollow(int count){
+	char *line = NULL;
+	size_t size = 0;
+	char *next;
+	int j;
+
+	replicaAccounts = count;
+	following = 1;
+	while(getline(&line, &size, primaryIn) > 0){
+		//Snapshot and commit records are applied to memory right away, a replica that paid the storage delay per write would never catch up
+		if(line[0] == 'S'){
+			int accountNum = strtol(line+2, &next, 10);
+			while(*next == ' '){
+				int balance = strtol(next, &next, 10);
+				if(accountNum >= 1 && accountNum <= replicaAccounts){
+					set_value(accountNum, balance);
+				}
+				accountNum++;
+			}
+		}
+		else if(line[0] == 'C'){
+			unsigned long long committed = strtoull(line+2, &next, 10);
+			int n = strtol(next, &next, 10);
+			for(j=0; j<n; j++){
+				int accountNum = strtol(next, &next, 10);
+				int balance = strtol(next, &next, 10);
+				if(accountNum >= 1 && accountNum <= replicaAccounts){
+					set_value(accountNum, balance);
+				}
+			}
+			double lag = (monotonicNs() - committed)/1e9;
+			totalLag += lag;
+			if(lag > maxLag){
+				maxLag = lag;
+			}
+			appliedRecords++;
+		}
+		//Checks are read from the replica's storage by its workers, the same way the primary would
+		else if(line[0] == 'Q'){
+			int requestId;
+			long sec, usec;
+			unsigned long long sent;
+			int accountNum;
+			if(sscanf(line+2, "%d %ld %ld %llu %d", &requestId, &sec, &usec, &sent, &accountNum) != 5){
+				continue;
+			}
+			lastCheck = monotonicNs();
+			if(firstCheck == 0){
+				firstCheck = lastCheck;
+			}
+			char cmd[32];
+			sprintf(cmd, "CHECK %d", accountNum);
+			struct timeval timeStart = {sec, usec};
+			struct timeval deadline = {0, 0};
+			pthread_mutex_lock(&queueMutex);
+			pushStarted(cmd, requestId, timeStart, deadline);
+			pthread_cond_signal(&queueNotEmpty);
+			pthread_mutex_unlock(&queueMutex);
+			servedChecks++;
+		}
+	}
+	free(line);
+	fclose(primaryIn);
+}
+
+//Read without replicasMutex, the numbers may be a moment out of date
+void replicationMetrics(FILE *out){
+	if(replicating){
+		fprintf(out, "# HELP bank_replicas Connected read replicas.\n# TYPE bank_replicas gauge\n");
+		fprintf(out, "bank_replicas %d\n", __atomic_load_n(&numReplicas, __ATOMIC_RELAXED));
+		fprintf(out, "# HELP bank_replication_records_total Committed transactions sent to the replicas.\n# TYPE bank_replication_records_total counter\n");
+		fprintf(out, "bank_replication_records_total %ld\n", __atomic_load_n(&commitRecords, __ATOMIC_RELAXED));
+		fprintf(out, "# HELP bank_replicas_dropped_total Replicas dropped for falling too far behind.\n# TYPE bank_replicas_dropped_total counter\n");
+		fprintf(out, "bank_replicas_dropped_total %ld\n", __atomic_load_n(&droppedReplicas, __ATOMIC_RELAXED));
+		fprintf(out, "# HELP bank_replica_checks_total Checks routed to replicas, by who answered them.\n# TYPE bank_replica_checks_total counter\n");
+		fprintf(out, "bank_replica_checks_total{answered_by=\"replica\"} %ld\n", __atomic_load_n(&answeredChecks, __ATOMIC_RELAXED));
+		fprintf(out, "bank_replica_checks_total{answered_by=\"primary\"} %ld\n", __atomic_load_n(&localFallbacks, __ATOMIC_RELAXED));
+		fprintf(out, "# HELP bank_replica_staleness_seconds Staleness bound of the checks answered by replicas.\n# TYPE bank_replica_staleness_seconds summary\n");
+		fprintf(out, "bank_replica_staleness_seconds_sum %.6f\n", totalStaleness);
+		fprintf(out, "bank_replica_staleness_seconds_count %ld\n", __atomic_load_n(&answeredChecks, __ATOMIC_RELAXED));
+	}
+	if(following){
+		fprintf(out, "# HELP bank_replica_lag_seconds Time from commit on the primary to apply on this replica.\n# TYPE bank_replica_lag_seconds summary\n");
+		fprintf(out, "bank_replica_lag_seconds_sum %.6f\n", totalLag);
+		fprintf(out, "bank_replica_lag_seconds_count %ld\n", __atomic_load_n(&appliedRecords, __ATOMIC_RELAXED));
+		fprintf(out, "# HELP bank_replica_lag_max_seconds Largest replication lag seen.\n# TYPE bank_replica_lag_max_seconds gauge\n");
+		fprintf(out, "bank_replica_lag_max_seconds %.6f\n", maxLag);
+		fprintf(out, "# HELP bank_replica_checks_served_total Checks this replica took from the primary.\n# TYPE bank_replica_checks_served_total counter\n");
+		fprintf(out, "bank_replica_checks_served_total %ld\n", __atomic_load_n(&servedChecks, __ATOMIC_RELAXED));
+	}
+}
+
+void replicaStats(FILE *out){
+	fprintf(out, "replica: %ld commit records applied", appliedRecords);
+	if(appliedRecords > 0){
+		fprintf(out, ", replication lag avg %.3f ms, max %.3f ms", totalLag/appliedRecords*1000, maxLag*1000);
+	}
+	fputc('\n', out);
+	if(servedChecks > 1){
+		double span = (lastCheck - firstCheck)/1e9;
+		fprintf(out, "replica: %ld checks served in %.3f s, %.1f checks/s\n", servedChecks, span, servedChecks/span);
+	}
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+/*
+ * Read replicas
+ * A primary started with --replicate=PATH listens for replicas on a Unix socket and sends each
+ * one a stream of text lines. Balances are absolute, so applying a record twice is harmless.
+ *
+ *   S <first> <balance> <balance> ...        snapshot of the accounts starting at first, sent on connect
+ *   SYNCED                                   end of the snapshot
+ *   C <ns> <n> <acct> <balance> ...          a committed transaction, with its monotonic commit time
+ *   Q <id> <sec> <usec> <ns> <acct>          a CHECK routed to the replica, answered with a normal BAL result line
+ *
+ * Commit records are sent while the transaction still holds its accounts, so every account's
+ * records arrive in commit order. A routed CHECK is behind every commit acknowledged before it was
+ * routed in the same stream, so its answer is never older than the moment it was routed.
+ * Records are only copied to each replica's own buffer under the commit lock, and a thread per
+ * replica writes them out. A replica more than 64 MB behind is dropped rather than waited on.
+ */
+
+//Primary side, start taking replica connections and optionally send them the single account CHECKs
+void replicationListen(char *path, int count, int routeChecks);
+
+//Send a committed transaction's new balances to every replica, called with the accounts still held
+void replicateCommit(int *ids, int n, int *balances);
+
+//Hand a single account CHECK to a replica, returns 0 if there is none to take it
+int routeCheck(int requestId, struct timeval timeStart, int accountNum);
+
+//Wait for routed CHECKs to be answered, end the streams and print the primary's replication stats
+void replicationClose();
+
+//Write whichever side's replication statistics as Prometheus text
+void replicationMetrics(FILE *out);
+
+//Replica side, connect to a primary and return the stream results are written back on
+FILE * replicaConnect(char *path);
+
+//Apply the primary's stream to accounts 1 to count and queue its CHECKs for the workers until the primary goes away
+void replicaFollow(int count);
+
+//Print the replica's lag and throughput
+void replicaStats(FILE *out);
@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "appserver.h"
+#include "restart.h"
+#include "results.h"
+
+unsigned long long monotonicNs();
+
+#define INPUT_READ 65536
+#define HANDOVER_FDS 5
+
+//What the old server sends first, along with its stdin, stdout, output file, balances and listening socket
+typedef struct handoverHeader{
+	char magic[8];
+	int nextId;
+	int numAccounts;
+	int binary;
+	//Queued requests that follow, and the bytes of input after them
+	int pending;
+	long leftover;
+} handoverHeader;
+
+//A queued request, followed by its command
+typedef struct pendingRequest{
+	int requestId;
+	int len;
+	struct timeval timeStart;
+	struct timeval deadline;
+} pendingRequest;
+
+//Input read from stdin but not yet returned as a line, it grows to hold the longest line
+char *inputBuf = NULL;
+long inputSize = 0;
+long inputStart = 0;
+long inputEnd = 0;
+int inputDone = 0;
+
+//The socket replacements connect to, the one that did, and the pipe that wakes the input reader for it
+int listener = -1;
+int replacement = -1;
+int wakeFds[2] = {-1, -1};
+int handoverWanted = 0;
+int accountsFd = -1;
+int handoverAccounts;
+//The first request ID this server gave out, and the connection to the server it took over from
+int firstId = 1;
+int oldServer = -1;
+
+//Wait for a replacement to connect, then wake the input reader
+void * acceptReplacement(void *arg){
+	int conn;
+	do{
+		conn = accept(listener, NULL, NULL);
+	} while(conn < 0 && errno == EINTR);
+	if(conn < 0){
+		perror("handover accept");
+		return NULL;
+	}
+	replacement = conn;
+	__atomic_store_n(&handoverWanted, 1, __ATOMIC_RELEASE);
+	if(write(wakeFds[1], "x", 1) != 1){
+		perror("handover wake");
+	}
+	return NULL;
+}
+
+//Start the thread waiting for a replacement on the listening socket
+void startAccepting(){
+	pthread_t thread;
+	if(pipe(wakeFds) != 0){
+		perror("handover pipe");
+		exit(1);
+	}
+	pthread_create(&thread, NULL, acceptReplacement, NULL);
+	pthread_detach(thread);
+}
+
+void handoverListen(char *path, int fd, int count){
+	struct sockaddr_un addr;
+	accountsFd = fd;
+	handoverAccounts = count;
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	unlink(path);
+	if(listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listener, 1) != 0){
+		fprintf(stderr, "Could not listen for a replacement on %s\n", path);
+		exit(1);
+	}
+	startAccepting();
+}
+
+int readRequest(char **line, size_t *size){
+	//Only the new part of the buffer is searched for the end of the line
+	long searched = inputStart;
+	while(1){
+		//A replacement takes the input from here, the buffered part goes along
+		if(__atomic_load_n(&handoverWanted, __ATOMIC_ACQUIRE)){
+			return -1;
+		}
+		long avail = inputEnd-inputStart;
+		char *newline = inputEnd > searched ? memchr(inputBuf+searched, '\n', inputEnd-searched) : NULL;
+		searched = inputEnd;
+		//A whole line, or what is left at the end of the input
+		if(newline || (inputDone && avail > 0)){
+			long len = newline ? newline-(inputBuf+inputStart) : avail;
+			if(len+1 > *size){
+				*size = len+1;
+				*line = realloc(*line, *size);
+			}
+			memcpy(*line, inputBuf+inputStart, len);
+			(*line)[len] = '\0';
+			inputStart += newline ? len+1 : len;
+			return 1;
+		}
+		if(inputDone){
+			return 0;
+		}
+
+		//Make room and wait for more input, or for a replacement
+		memmove(inputBuf, inputBuf+inputStart, avail);
+		searched -= inputStart;
+		inputStart = 0;
+		inputEnd = avail;
+		if(inputSize-inputEnd < INPUT_READ){
+			inputSize = inputSize*2 > inputEnd+INPUT_READ ? inputSize*2 : inputEnd+INPUT_READ;
+			inputBuf = realloc(inputBuf, inputSize);
+		}
+		struct pollfd fds[2] = {{0, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+		if(poll(fds, wakeFds[0] >= 0 ? 2 : 1, -1) < 0){
+			continue;
+		}
+		if(fds[0].revents){
+			long got = read(0, inputBuf+inputEnd, inputSize-inputEnd);
+			if(got > 0){
+				inputEnd += got;
+			} else if(got == 0 || errno != EINTR){
+				inputDone = 1;
+			}
+		}
+	}
+}
+
+//Write all of len bytes, returns 0 if the connection failed
+int writeAll(int fd, const void *data, long len){
+	const char *at = data;
+	while(len > 0){
+		long done = write(fd, at, len);
+		if(done <= 0){
+			if(done < 0 && errno == EINTR){
+				continue;
+			}
+			return 0;
+		}
+		at += done;
+		len -= done;
+	}
+	return 1;
+}
+
+//Read all of len bytes, returns 0 if the connection ended first
+int readAll(int fd, void *data, long len){
+	char *at = data;
+	while(len > 0){
+		long done = read(fd, at, len);
+		if(done <= 0){
+			if(done < 0 && errno == EINTR){
+				continue;
+			}
+			return 0;
+		}
+		at += done;
+		len -= done;
+	}
+	return 1;
+}
+
+void handover(int nextId, FILE *output, int binary){
+	unsigned long long pauseStart = monotonicNs();
+	int pending, i;
+
+	//Requests no worker has started go to the replacement with their IDs
+	pthread_mutex_lock(&queueMutex);
+	request *waiting = queueDetach(&pending);
+	pthread_mutex_unlock(&queueMutex);
+	int firstWaiting = waiting ? waiting->requestId : nextId;
+
+	//Every request before those finishes by handing over its last piece of result exactly once
+	while(resultsCompleted() < firstWaiting-firstId){
+		struct timespec wait = {0, 100000};
+		nanosleep(&wait, NULL);
+	}
+	unsigned long long drained = monotonicNs();
+	resultsClose(firstWaiting-1);
+	fflush(output);
+	fflush(stdout);
+
+	//The header carries the file descriptors
+	handoverHeader header;
+	memcpy(header.magic, "BANKHND1", 8);
+	header.nextId = nextId;
+	header.numAccounts = handoverAccounts;
+	header.binary = binary;
+	header.pending = pending;
+	header.leftover = inputEnd-inputStart;
+	int fds[HANDOVER_FDS] = {0, 1, fileno(output), accountsFd, listener};
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov = {&header, sizeof(header)};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	int sent = sendmsg(replacement, &msg, 0) == sizeof(header);
+
+	while(waiting){
+		request *next = waiting->next;
+		pendingRequest item = {waiting->requestId, strlen(waiting->command), waiting->timeStart, waiting->deadline};
+		sent = sent && writeAll(replacement, &item, sizeof(item)) && writeAll(replacement, waiting->command, item.len);
+		free(waiting->command);
+		free(waiting);
+		waiting = next;
+	}
+	sent = sent && writeAll(replacement, inputBuf+inputStart, header.leftover);
+
+	//The old server goes away only once the new one reads the input
+	char ready;
+	if(!sent || !readAll(replacement, &ready, 1)){
+		fprintf(stderr, "handover: the replacement went away, %d queued requests from ID %d were not served\n", pending, firstWaiting);
+		exit(1);
+	}
+	unsigned long long pauseEnd = monotonicNs();
+	fprintf(stderr, "handover: %d queued requests and %ld bytes of input handed over at ID %d, paused %.2f ms (%.2f ms finishing started requests)\n",
+		pending, header.leftover, nextId, (pauseEnd-pauseStart)/1e6, (drained-pauseStart)/1e6);
+	for(i=0; i<HANDOVER_FDS; i++){
+		close(fds[i]);
+	}
+	exit(0);
+}
+
+int takeover(char *path, int *numAccounts, FILE **output, int *binary){
+	struct sockaddr_un addr;
+	int i;
+	oldServer = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	if(oldServer < 0 || connect(oldServer, (struct sockaddr*) &addr, sizeof(addr)) != 0){
+		fprintf(stderr, "Could not connect to the server to take over at %s\n", path);
+		exit(1);
+	}
+
+	handoverHeader header;
+	int fds[HANDOVER_FDS];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov = {&header, sizeof(header)};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	int got = recvmsg(oldServer, &msg, 0);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(got <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))){
+		fprintf(stderr, "The server at %s did not hand over\n", path);
+		exit(1);
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	//The file descriptors come with the first bytes, the rest of the header may come later
+	if(!readAll(oldServer, (char*) &header+got, sizeof(header)-got) || memcmp(header.magic, "BANKHND1", 8) != 0){
+		fprintf(stderr, "The server at %s did not hand over\n", path);
+		exit(1);
+	}
+
+	//Carry on with the same input, prompts, output file and balances
+	dup2(fds[0], 0);
+	dup2(fds[1], 1);
+	close(fds[0]);
+	close(fds[1]);
+	*numAccounts = header.numAccounts;
+	*binary = header.binary;
+	*output = fdopen(fds[2], "w");
+	if(*output == NULL || !attach_accounts(fds[3], header.numAccounts)){
+		fprintf(stderr, "Could not take over the output file or the balances\n");
+		exit(1);
+	}
+	accountsFd = fds[3];
+	handoverAccounts = header.numAccounts;
+	listener = fds[4];
+
+	//Queue the requests the old server hadn't started, as they were
+	int firstWaiting = header.nextId;
+	pthread_mutex_lock(&queueMutex);
+	for(i=0; i<header.pending; i++){
+		pendingRequest item;
+		if(!readAll(oldServer, &item, sizeof(item))){
+			fprintf(stderr, "The server at %s went away during the handover\n", path);
+			exit(1);
+		}
+		char *command = malloc(item.len+1);
+		if(!readAll(oldServer, command, item.len)){
+			fprintf(stderr, "The server at %s went away during the handover\n", path);
+			exit(1);
+		}
+		command[item.len] = '\0';
+		if(i == 0){
+			firstWaiting = item.requestId;
+		}
+		pushStarted(command, item.requestId, item.timeStart, item.deadline);
+		free(command);
+	}
+	pthread_mutex_unlock(&queueMutex);
+	inputSize = header.leftover+INPUT_READ;
+	inputBuf = malloc(inputSize);
+	if(!readAll(oldServer, inputBuf, header.leftover)){
+		fprintf(stderr, "The server at %s went away during the handover\n", path);
+		exit(1);
+	}
+	inputEnd = header.leftover;
+
+	firstId = firstWaiting;
+	resultsResume(firstWaiting);
+	fprintf(stderr, "took over %d accounts, %d queued requests and %ld bytes of input, next ID %d\n", header.numAccounts, header.pending, header.leftover, header.nextId);
+	//The same socket takes the next replacement
+	startAccepting();
+	return header.nextId;
+}
+
+void takeoverDone(){
+	if(oldServer < 0){
+		return;
+	}
+	if(!writeAll(oldServer, "r", 1)){
+		fprintf(stderr, "The old server went away before the handover was done\n");
+	}
+	close(oldServer);
+	oldServer = -1;
+}
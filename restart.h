@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+/*
+ * Hot restart
+ * A server started with --handover=PATH keeps its balances in a shared memory segment and waits
+ * on a Unix socket at PATH for its replacement. A new server started with --takeover=PATH
+ * connects there, and the old one
+ *
+ *   stops reading its input between two lines
+ *   takes the requests no worker has started out of its queue
+ *   waits for the started ones to finish and writes out their results
+ *   sends its stdin, stdout, output file, balances and the listening socket itself with
+ *   SCM_RIGHTS, then the next request ID, the queued requests and the input it read but
+ *   hadn't queued yet
+ *
+ * and exits once the new server is ready to read input. The new server maps the same balances,
+ * queues the requests with their original IDs and arrival times and carries on reading the same
+ * input, so no request is lost or run twice. It can be restarted again the same way.
+ */
+
+//Start waiting for a replacement on a Unix socket at path, fd is the shared segment of the count accounts
+void handoverListen(char *path, int fd, int count);
+
+//Read one line of input of any length without its newline, line and size grow like getline
+//Returns 1 for a line, 0 at the end of the input and -1 when a replacement has connected
+int readRequest(char **line, size_t *size);
+
+//Hand everything over to the replacement that connected and exit, called by the thread reading input
+void handover(int nextId, FILE *output, int binary);
+
+//Take over from the server listening at path, its balances become this server's accounts
+//Sets the number of accounts, the output file and its format, and returns the next request ID
+int takeover(char *path, int *numAccounts, FILE **output, int *binary);
+
+//Tell the old server this one is reading input now, so it can exit
+void takeoverDone();
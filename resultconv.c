@@ -0,0 +1,72 @@
+/**
+* Turns a binary result log written with --output-format=binary back into
+* the server's text format, checking the checksums along the way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "results.h"
+
+unsigned getLE32(const unsigned char *in);
+
+int main(int argc, char** argv) {
+
+	if (argc < 2) {
+		printf("Usage: ./resultconv <binary log> [text file]\n");
+		printf("Writes the results as text lines to the text file, or stdout, and exits with 1 if the log is damaged.\n");
+		return 0;
+	}
+
+	FILE *in = fopen(argv[1], "rb");
+	if (in == NULL) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return 1;
+	}
+	FILE *out = stdout;
+	if (argc > 2) {
+		out = fopen(argv[2], "w");
+		if (out == NULL) {
+			fprintf(stderr, "cannot create %s\n", argv[2]);
+			return 1;
+		}
+	}
+
+	unsigned char header[16];
+	if (fread(header, 1, 16, in) != 16 || memcmp(header, "BANKRES1", 8) != 0 || getLE32(header+8) != RESULT_RECORD_SIZE) {
+		fprintf(stderr, "%s is not a binary result log\n", argv[1]);
+		return 1;
+	}
+
+	unsigned char record[RESULT_RECORD_SIZE];
+	char line[256];
+	unsigned crc = 0;
+	unsigned since = 0;
+	long records = 0, checksums = 0, damaged = 0;
+	size_t got;
+	while ((got = fread(record, 1, RESULT_RECORD_SIZE, in)) == RESULT_RECORD_SIZE) {
+		if (record[4] == RESULT_CHECKSUM) {
+			if (getLE32(record+8) != crc || getLE32(record+12) != since) {
+				fprintf(stderr, "checksum mismatch in the %u records before record %ld\n", since, records);
+				damaged++;
+			}
+			checksums++;
+			crc = 0;
+			since = 0;
+			continue;
+		}
+		crc = resultsCrc(crc, record, RESULT_RECORD_SIZE);
+		since++;
+		records++;
+		fwrite(line, 1, resultFormat(line, record), out);
+	}
+
+	//A complete log ends with a checksum record
+	if (got > 0 || since > 0) {
+		fprintf(stderr, "the log is truncated, the last %u records are not covered by a checksum\n", since);
+		damaged++;
+	}
+	fprintf(stderr, "%ld records, %ld checksums, %s\n", records, checksums, damaged ? "DAMAGED" : "all checksums match");
+	fclose(out);
+	return damaged ? 1 : 0;
+}
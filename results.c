@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "probes.h"
+#include "results.h"
+#include "timing.h"
+
+//One request's worth of output waiting in the reorder buffer
+typedef struct resultSlot{
+	char *text;
+	int len;
+	int size;
+	int done;
+	struct timeval completed;
+} resultSlot;
+
+//A whole result handed over more than a window ahead by a thread that mustn't wait
+typedef struct parkedResult{
+	int requestId;
+	char *text;
+	int len;
+	struct parkedResult *next;
+} parkedResult;
+
+//This is the function the writer thread runs in ordered mode
+void * writeOrdered();
+void fillSlot(int requestId, const char *text, int len, int last);
+
+FILE *resultsOut;
+int reorderWindow;
+resultSlot *slots;
+int nextId = 1;
+int endId = -1;
+pthread_mutex_t slotsMutex;
+pthread_cond_t headReady;
+pthread_cond_t slotFree;
+pthread_t writer;
+//Parked results in request ID order, the writer moves them into the buffer as the window reaches them
+parkedResult *parked = NULL;
+
+//Reorder buffer statistics
+int occupancy = 0;
+int maxOccupancy = 0;
+long resultsWritten = 0;
+long workerStalls = 0;
+long parkedResults = 0;
+double totalDelay = 0;
+double maxDelay = 0;
+
+//Output format, and the binary log's running checksum
+int resultsBinary = 0;
+unsigned runningCrc = 0;
+int sinceChecksum = 0;
+long bytesOut = 0;
+long resultsDone = 0;
+int resumed = 0;
+
+//Names of the record types and error reasons in the text format
+char *resultNames[] = {"", "BAL", "OK", "ISF", "TIMEOUT", "BALS", "", "LOADED", "DUMPED", "SNAPSHOT", "ERROR", "CHECKSUM", "HISTORY", ""};
+char *errorReasons[] = {"", "cannot open the file", "cannot create the file", "reading the file failed", "writing the file failed", "writing the snapshot failed", "the ledger is off"};
+
+void putLE32(unsigned char *out, unsigned value){
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+void putLE64(unsigned char *out, unsigned long long value){
+	putLE32(out, value);
+	putLE32(out+4, value >> 32);
+}
+
+unsigned getLE32(const unsigned char *in){
+	return in[0] | in[1]<<8 | in[2]<<16 | (unsigned) in[3]<<24;
+}
+
+unsigned long long getLE64(const unsigned char *in){
+	return getLE32(in) | (unsigned long long) getLE32(in+4) << 32;
+}
+
+unsigned resultsCrc(unsigned crc, const unsigned char *data, int len){
+	static unsigned table[256];
+	static int tableReady = 0;
+	int i, k;
+	if(!tableReady){
+		for(i=0; i<256; i++){
+			unsigned c = i;
+			for(k=0; k<8; k++){
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		tableReady = 1;
+	}
+	crc = ~crc;
+	for(i=0; i<len; i++){
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+//Write out the checksum of the records since the last one
+void writeChecksum(){
+	unsigned char record[RESULT_RECORD_SIZE] = {0};
+	record[4] = RESULT_CHECKSUM;
+	putLE32(record+8, runningCrc);
+	putLE32(record+12, sinceChecksum);
+	fwrite(record, 1, RESULT_RECORD_SIZE, resultsOut);
+	bytesOut += RESULT_RECORD_SIZE;
+	runningCrc = 0;
+	sinceChecksum = 0;
+}
+
+//Put results into the file, only ever called by one thread at a time
+void emit(const char *text, int len){
+	if(!resultsBinary){
+		fwrite(text, 1, len, resultsOut);
+		bytesOut += len;
+		return;
+	}
+	//Go a record at a time so the checksums fall every RESULT_CHECKSUM_EVERY records
+	while(len > 0){
+		int records = RESULT_CHECKSUM_EVERY - sinceChecksum;
+		if(records*RESULT_RECORD_SIZE > len){
+			records = len/RESULT_RECORD_SIZE;
+		}
+		fwrite(text, 1, records*RESULT_RECORD_SIZE, resultsOut);
+		runningCrc = resultsCrc(runningCrc, (const unsigned char*) text, records*RESULT_RECORD_SIZE);
+		sinceChecksum += records;
+		bytesOut += records*RESULT_RECORD_SIZE;
+		text += records*RESULT_RECORD_SIZE;
+		len -= records*RESULT_RECORD_SIZE;
+		if(sinceChecksum == RESULT_CHECKSUM_EVERY){
+			writeChecksum();
+		}
+	}
+}
+
+//Put one result into out as a line of text
+int encodeText(char *out, int requestId, int type, int value, int extra, struct timeval start, struct timeval finish){
+	int len;
+	switch(type){
+		case RESULT_ACCOUNT:
+			return sprintf(out, "%d %d\n", extra, value);
+		case RESULT_ENTRY:
+			return sprintf(out, "%d %d %d AT %d.%06d\n", requestId, value, extra, (int) finish.tv_sec, (int) finish.tv_usec);
+		case RESULT_OK:
+		case RESULT_TIMEOUT:
+			len = sprintf(out, "%d %s", requestId, resultNames[type]);
+			break;
+		case RESULT_SNAPSHOT:
+			len = sprintf(out, "%d SNAPSHOT %d THROUGH %d", requestId, value, extra);
+			break;
+		case RESULT_ERROR:
+			len = sprintf(out, "%d ERROR %s", requestId, errorReasons[value]);
+			break;
+		default:
+			len = sprintf(out, "%d %s %d", requestId, resultNames[type], value);
+	}
+	return len + sprintf(out+len, " TIME %d.%06d %d.%06d\n", (int) start.tv_sec, (int) start.tv_usec, (int) finish.tv_sec, (int) finish.tv_usec);
+}
+
+int resultEncode(char *out, int requestId, int type, int value, int extra, struct timeval start, struct timeval finish){
+	if(resultsBinary){
+		unsigned char *record = (unsigned char*) out;
+		memset(record, 0, RESULT_RECORD_SIZE);
+		putLE32(record, requestId);
+		record[4] = type;
+		putLE32(record+8, value);
+		putLE32(record+12, extra);
+		putLE64(record+16, start.tv_sec*1000000000ULL + start.tv_usec*1000ULL);
+		putLE64(record+24, finish.tv_sec*1000000000ULL + finish.tv_usec*1000ULL);
+		return RESULT_RECORD_SIZE;
+	}
+	return encodeText(out, requestId, type, value, extra, start, finish);
+}
+
+int resultFormat(char *out, const unsigned char *record){
+	unsigned long long start = getLE64(record+16);
+	unsigned long long finish = getLE64(record+24);
+	struct timeval startTv = {start/1000000000ULL, start%1000000000ULL/1000};
+	struct timeval finishTv = {finish/1000000000ULL, finish%1000000000ULL/1000};
+	int type = record[4];
+
+	if(type < RESULT_BAL || type > RESULT_ENTRY || type == RESULT_CHECKSUM || (type == RESULT_ERROR && (getLE32(record+8) < ERROR_OPEN || getLE32(record+8) > ERROR_NO_LEDGER))){
+		return sprintf(out, "unknown record type %d\n", type);
+	}
+	return encodeText(out, getLE32(record), type, getLE32(record+8), getLE32(record+12), startTv, finishTv);
+}
+
+void resultsResume(int firstId){
+	resumed = 1;
+	nextId = firstId;
+}
+
+void resultsInit(FILE *out, int window, int binary){
+	resultsOut = out;
+	reorderWindow = window;
+	resultsBinary = binary;
+	if(binary && !resumed){
+		unsigned char header[16];
+		memcpy(header, "BANKRES1", 8);
+		putLE32(header+8, RESULT_RECORD_SIZE);
+		putLE32(header+12, RESULT_CHECKSUM_EVERY);
+		fwrite(header, 1, 16, out);
+		bytesOut = 16;
+	}
+	if(window <= 0){
+		return;
+	}
+
+	slots = calloc(window, sizeof(resultSlot));
+	pthread_mutex_init(&slotsMutex, NULL);
+	pthread_cond_init(&headReady, NULL);
+	pthread_cond_init(&slotFree, NULL);
+	pthread_create(&writer, NULL, writeOrdered, NULL);
+}
+
+void resultWrite(int requestId, const char *text, int len, int last){
+	BANK_PROBE3(result, requestId, len, last);
+	int previous = timingEnter(STATE_OUTPUT);
+	//Without a reorder buffer the result goes straight to the file
+	if(reorderWindow <= 0){
+		if(len > 0){
+			flockfile(resultsOut);
+			emit(text, len);
+			funlockfile(resultsOut);
+		}
+		//A request is only counted once its text is in the file or the buffer, so nothing counted is still being written
+		if(last){
+			__sync_fetch_and_add(&resultsDone, 1);
+		}
+		timingLeave(previous);
+		return;
+	}
+
+	pthread_mutex_lock(&slotsMutex);
+	//Only block when the head request is holding back more than a full window
+	if(requestId >= nextId+reorderWindow){
+		workerStalls++;
+		while(requestId >= nextId+reorderWindow){
+			pthread_cond_wait(&slotFree, &slotsMutex);
+		}
+	}
+	fillSlot(requestId, text, len, last);
+	pthread_mutex_unlock(&slotsMutex);
+	timingLeave(previous);
+}
+
+void resultPost(int requestId, const char *text, int len){
+	if(reorderWindow <= 0){
+		resultWrite(requestId, text, len, 1);
+		return;
+	}
+	BANK_PROBE3(result, requestId, len, 1);
+	int previous = timingEnter(STATE_OUTPUT);
+	pthread_mutex_lock(&slotsMutex);
+	if(requestId < nextId+reorderWindow){
+		fillSlot(requestId, text, len, 1);
+		pthread_mutex_unlock(&slotsMutex);
+		timingLeave(previous);
+		return;
+	}
+
+	//Too far ahead, keep a copy aside in ID order instead of waiting
+	parkedResult *result = malloc(sizeof(parkedResult));
+	result->requestId = requestId;
+	result->text = malloc(len > 0 ? len : 1);
+	memcpy(result->text, text, len);
+	result->len = len;
+	parkedResult **at = &parked;
+	while(*at && (*at)->requestId < requestId){
+		at = &(*at)->next;
+	}
+	result->next = *at;
+	*at = result;
+	parkedResults++;
+	pthread_mutex_unlock(&slotsMutex);
+	timingLeave(previous);
+}
+
+//Add text to a request's slot, called with the slots lock held and the request inside the window
+void fillSlot(int requestId, const char *text, int len, int last){
+	resultSlot *slot = &slots[requestId % reorderWindow];
+	if(slot->len == 0 && !slot->done){
+		occupancy++;
+		if(occupancy > maxOccupancy){
+			maxOccupancy = occupancy;
+		}
+	}
+	if(slot->len+len > slot->size){
+		slot->size = slot->len+len > 2*slot->size ? slot->len+len : 2*slot->size;
+		slot->text = realloc(slot->text, slot->size);
+	}
+	memcpy(slot->text+slot->len, text, len);
+	slot->len += len;
+
+	if(last){
+		resultsDone++;
+		slot->done = 1;
+		gettimeofday(&slot->completed, NULL);
+		if(requestId == nextId){
+			pthread_cond_signal(&headReady);
+		}
+	}
+}
+
+//Write out results in request ID order as soon as the head of the buffer is complete
+void * writeOrdered(){
+	pthread_mutex_lock(&slotsMutex);
+	while(endId < 0 || nextId <= endId){
+		resultSlot *slot = &slots[nextId % reorderWindow];
+		if(!slot->done){
+			pthread_cond_wait(&headReady, &slotsMutex);
+			continue;
+		}
+
+		//Take the text out of the slot so workers can reuse it while we write
+		char *text = slot->text;
+		int len = slot->len;
+		struct timeval completed = slot->completed;
+		slot->text = NULL;
+		slot->len = 0;
+		slot->size = 0;
+		slot->done = 0;
+		occupancy--;
+		nextId++;
+		//Parked results the window has reached go into the buffer now
+		while(parked && parked->requestId < nextId+reorderWindow){
+			parkedResult *result = parked;
+			parked = result->next;
+			fillSlot(result->requestId, result->text, result->len, 1);
+			free(result->text);
+			free(result);
+		}
+		pthread_cond_broadcast(&slotFree);
+		pthread_mutex_unlock(&slotsMutex);
+
+		emit(text, len);
+		free(text);
+
+		//Head of line delay is how long the result sat complete in the buffer
+		struct timeval written;
+		gettimeofday(&written, NULL);
+		double delay = (written.tv_sec-completed.tv_sec) + (written.tv_usec-completed.tv_usec)/1000000.0;
+		totalDelay += delay;
+		if(delay > maxDelay){
+			maxDelay = delay;
+		}
+		resultsWritten++;
+
+		pthread_mutex_lock(&slotsMutex);
+	}
+	pthread_mutex_unlock(&slotsMutex);
+	return NULL;
+}
+
+long resultsCompleted(){
+	return __atomic_load_n(&resultsDone, __ATOMIC_ACQUIRE);
+}
+
+int resultsWindow(){
+	return reorderWindow > 0 ? reorderWindow : 0;
+}
+
+int resultsWriter(pthread_t *thread){
+	if(reorderWindow <= 0){
+		return 0;
+	}
+	*thread = writer;
+	return 1;
+}
+
+//Read without the slots lock, the numbers may be a moment out of date
+void resultsMetrics(FILE *out){
+	if(reorderWindow <= 0){
+		return;
+	}
+	long written = __atomic_load_n(&resultsWritten, __ATOMIC_RELAXED);
+	fprintf(out, "# HELP bank_reorder_occupancy Requests held in the reorder buffer.\n# TYPE bank_reorder_occupancy gauge\n");
+	fprintf(out, "bank_reorder_occupancy %d\n", __atomic_load_n(&occupancy, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_reorder_max_occupancy Most requests ever held in the reorder buffer.\n# TYPE bank_reorder_max_occupancy gauge\n");
+	fprintf(out, "bank_reorder_max_occupancy %d\n", __atomic_load_n(&maxOccupancy, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_reorder_worker_stalls_total Times a worker waited for room in the reorder buffer.\n# TYPE bank_reorder_worker_stalls_total counter\n");
+	fprintf(out, "bank_reorder_worker_stalls_total %ld\n", __atomic_load_n(&workerStalls, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP bank_head_of_line_delay_seconds Time complete results waited for earlier ones.\n# TYPE bank_head_of_line_delay_seconds summary\n");
+	fprintf(out, "bank_head_of_line_delay_seconds_sum %.6f\n", totalDelay);
+	fprintf(out, "bank_head_of_line_delay_seconds_count %ld\n", written);
+}
+
+void resultsClose(int lastId){
+	if(reorderWindow > 0){
+		pthread_mutex_lock(&slotsMutex);
+		endId = lastId;
+		pthread_cond_signal(&headReady);
+		pthread_mutex_unlock(&slotsMutex);
+		pthread_join(writer, NULL);
+
+		fprintf(stderr, "reorder buffer: window %d, max occupancy %d, %ld results, %ld worker stalls, %ld parked, head-of-line delay avg %.6f max %.6f seconds\n",
+			reorderWindow, maxOccupancy, resultsWritten, workerStalls, parkedResults, resultsWritten ? totalDelay/resultsWritten : 0, maxDelay);
+		free(slots);
+	}
+
+	//The log ends with the checksum of whatever came after the last one
+	if(resultsBinary && sinceChecksum > 0){
+		writeChecksum();
+	}
+	fprintf(stderr, "output: %s, %ld results, %ld bytes, %.1f bytes per result\n", resultsBinary ? "binary" : "text", resultsDone, bytesOut, resultsDone ? (double) bytesOut/resultsDone : 0);
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/*
+ * Binary result log
+ * With binary set the output file is the 16 byte header "BANKRES1", the record size and the
+ * checksum interval (32 bit little-endian), followed by fixed size little-endian records:
+ *
+ *   uint32 request ID, uint8 type, 3 bytes of 0, int32 value, int32 extra,
+ *   uint64 start and uint64 finish in nanoseconds since the epoch
+ *
+ * value is the balance of BAL and ACCOUNT, the account of ISF, the count of BALS, LOADED,
+ * DUMPED, SNAPSHOT and HISTORY, the reason of ERROR and the delta of ENTRY. extra is the account
+ * of ACCOUNT and HISTORY, the through ID of SNAPSHOT and the balance of ENTRY. An ENTRY carries
+ * the ID of the TRANS it records and its commit time as both start and finish. Every RESULT_CHECKSUM_EVERY records, and at the end, a CHECKSUM record holds the
+ * CRC-32 of the bytes since the previous one (or the header) in value and its record count in extra.
+ * ./resultconv turns a binary log back into the text format.
+ */
+
+#define RESULT_RECORD_SIZE 32
+#define RESULT_CHECKSUM_EVERY 1024
+
+enum {RESULT_BAL = 1, RESULT_OK, RESULT_ISF, RESULT_TIMEOUT, RESULT_BALS, RESULT_ACCOUNT, RESULT_LOADED, RESULT_DUMPED, RESULT_SNAPSHOT, RESULT_ERROR, RESULT_CHECKSUM, RESULT_HISTORY, RESULT_ENTRY};
+
+//Reasons for an ERROR result
+enum {ERROR_OPEN = 1, ERROR_CREATE, ERROR_READ, ERROR_WRITE, ERROR_SNAPSHOT, ERROR_NO_LEDGER};
+
+//Setup the result writer, a window of 0 writes results in completion order
+//otherwise results are written in request ID order through a reorder buffer of that many requests
+//binary picks the binary result log over text lines
+void resultsInit(FILE *out, int window, int binary);
+
+//Continue the output of a server that handed over to this one, call before resultsInit
+//The file already has its header, and the first result to write is firstId's
+void resultsResume(int firstId);
+
+//Put one result into out in the output format and return its length, at most 128 bytes
+int resultEncode(char *out, int requestId, int type, int value, int extra, struct timeval start, struct timeval finish);
+
+//Turn a binary record into its text line, returns the length
+int resultFormat(char *out, const unsigned char *record);
+
+//CRC-32 of len bytes, continuing from crc (start with 0)
+unsigned resultsCrc(unsigned crc, const unsigned char *data, int len);
+
+//Hand over the text of a result, last is set on the final piece of text for that request
+//Every request has to call this with last set exactly once, even when it has no text
+void resultWrite(int requestId, const char *text, int len, int last);
+
+//Hand over the whole text of a result without ever waiting for room in the reorder buffer
+//One more than a window ahead is parked until the window reaches it, for threads the head request may be queued behind
+void resultPost(int requestId, const char *text, int len);
+
+//Number of requests that have handed over their last piece of text
+long resultsCompleted();
+
+//The reorder window, 0 when results are written in completion order
+int resultsWindow();
+
+//Find the writer thread, returns 0 when results are written by the workers themselves
+int resultsWriter(pthread_t *thread);
+
+//Write the reorder buffer's statistics as Prometheus text, nothing in completion order mode
+void resultsMetrics(FILE *out);
+
+//Write everything still buffered up to lastId, stop the writer and print its statistics
+void resultsClose(int lastId);
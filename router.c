@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "appserver.h"
+#include "parse.h"
+#include "results.h"
+
+//A connection from a coordinator thread to one partition server
+typedef struct partitionConn{
+	FILE *in;
+	FILE *out;
+} partitionConn;
+
+//This is the function each coordinator thread runs, it takes requests from the queue and sends them to the partitions
+void * coordinate();
+
+//Start a partition server process and connect to one
+void startPartition(int k);
+void connectPartition(int k, partitionConn *conn);
+
+//Send a line to a partition and read its one line reply into reply
+void sendLine(partitionConn *conn, char *line);
+void readReply(partitionConn *conn, char *reply, int size);
+
+//The partition that owns an account
+int partitionOf(int accountNum);
+
+void routeCheck(partitionConn *conns, request *req, int accountNum);
+void routeBulkCheck(partitionConn *conns, request *req, int *ids, int count);
+void routeTrans(partitionConn *conns, request *req, char **command, int parts);
+
+int partitions = 2;
+int numAccounts;
+char *serverPath = "./appserver";
+char **serverOptions;
+int numServerOptions = 0;
+char socketPaths[64][108];
+pid_t partitionPids[64];
+
+int id = 1;
+int running = 1;
+
+//Optional settings given after the required arguments
+struct option longOptions[] = {
+	{"partitions", required_argument, NULL, 'p'},
+	{"server", required_argument, NULL, 's'},
+	{"ordered", optional_argument, NULL, 'o'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char *argv[]){
+	int orderedWindow = 0;
+	int opt;
+	int i;
+
+	while((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1){
+		switch(opt){
+			case 'p':
+				partitions = atoi(optarg);
+				break;
+			case 's':
+				serverPath = optarg;
+				break;
+			case 'o':
+				orderedWindow = optarg ? atoi(optarg) : 1024;
+				break;
+			default:
+				argc = 0;
+		}
+	}
+
+	//Check for valid arguments to the program
+	if(argc - optind < 3 || partitions < 1 || partitions > 64){
+		printf("Launch the router with the following syntax\n");
+		printf("./router <# of coordinator threads> <# of accounts> <output file> [options] [-- server options]\n");
+		printf("  --partitions=N      number of partition server processes, each owning a range of accounts (default 2, at most 64)\n");
+		printf("  --server=PATH       partition server program (default ./appserver)\n");
+		printf("  --ordered[=WINDOW]  write results in request ID order, see the server's option of the same name\n");
+		printf("Anything after the output file is passed on to every partition server\n");
+		exit(1);
+	}
+	int coordinators = atoi(argv[optind]);
+	numAccounts = atoi(argv[optind+1]);
+	FILE *output = fopen(argv[optind+2], "w");
+	serverOptions = &argv[optind+3];
+	numServerOptions = argc-optind-3;
+	if(numServerOptions > 0 && strcmp(serverOptions[0], "--") == 0){
+		serverOptions++;
+		numServerOptions--;
+	}
+	if(partitions > numAccounts){
+		partitions = numAccounts;
+	}
+
+	queueInit(0);
+	resultsInit(output, orderedWindow, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i=0; i<partitions; i++){
+		startPartition(i);
+	}
+
+	pthread_t threads[coordinators];
+	for(i=0; i<coordinators; i++){
+		pthread_create(&threads[i], NULL, coordinate, NULL);
+	}
+
+	//Read requests the same way the server does, lines have no length limit
+	struct timeval noDeadline = {0, 0};
+	char *line = NULL;
+	size_t lineSize = 0;
+	while(running){
+		printf("> ");
+
+		ssize_t len = getline(&line, &lineSize, stdin);
+		char *request = line;
+		if(len == -1){
+			request = "END";
+		} else if(len > 0 && line[len-1] == '\n'){
+			line[len-1] = '\0';
+		}
+
+		if(strcmp(request, "END") == 0){
+			pthread_mutex_lock(&queueMutex);
+			running = 0;
+			pthread_cond_broadcast(&queueNotEmpty);
+			pthread_mutex_unlock(&queueMutex);
+			break;
+		}
+
+		pthread_mutex_lock(&queueMutex);
+		push(request, id, noDeadline);
+		pthread_cond_signal(&queueNotEmpty);
+		printf("< ID %d\n", id);
+		pthread_mutex_unlock(&queueMutex);
+		id++;
+	}
+
+	free(line);
+
+	for(i=0; i<coordinators; i++){
+		pthread_join(threads[i], NULL);
+	}
+	resultsClose(id-1);
+
+	//Tell every partition server to end and wait for it
+	for(i=0; i<partitions; i++){
+		partitionConn conn;
+		connectPartition(i, &conn);
+		sendLine(&conn, "END");
+		fclose(conn.in);
+		fclose(conn.out);
+		waitpid(partitionPids[i], NULL, 0);
+		unlink(socketPaths[i]);
+	}
+	fclose(output);
+	return 0;
+}
+
+//Partition k owns accounts base+1 to base+count, with the accounts split as evenly as possible
+int partitionBase(int k){
+	return (long) numAccounts*k/partitions;
+}
+
+int partitionOf(int accountNum){
+	int k = (long) (accountNum-1)*partitions/numAccounts;
+	//Rounding can put an account one partition off
+	while(k > 0 && accountNum <= partitionBase(k)){
+		k--;
+	}
+	while(k < partitions-1 && accountNum > partitionBase(k+1)){
+		k++;
+	}
+	return k;
+}
+
+void startPartition(int k){
+	char count[16], base[32], listen[128];
+	int base0 = partitionBase(k);
+	sprintf(socketPaths[k], "/tmp/bank-router-%d-%d.sock", getpid(), k);
+	sprintf(count, "%d", partitionBase(k+1)-base0);
+	sprintf(base, "--partition=%d", base0);
+	sprintf(listen, "--listen=%s", socketPaths[k]);
+
+	pid_t pid = fork();
+	if(pid == 0){
+		char *args[numServerOptions+7];
+		int j;
+		args[0] = serverPath;
+		args[1] = "1";
+		args[2] = count;
+		args[3] = "/dev/null";
+		args[4] = base;
+		args[5] = listen;
+		for(j=0; j<numServerOptions; j++){
+			args[6+j] = serverOptions[j];
+		}
+		args[6+numServerOptions] = NULL;
+		execv(serverPath, args);
+		perror(serverPath);
+		exit(1);
+	}
+	partitionPids[k] = pid;
+}
+
+void connectPartition(int k, partitionConn *conn){
+	struct sockaddr_un addr;
+	int attempts;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPaths[k], sizeof(addr.sun_path)-1);
+
+	//The partition server may still be starting up
+	for(attempts=0; attempts<500; attempts++){
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0){
+			conn->in = fdopen(fd, "r");
+			conn->out = fdopen(dup(fd), "w");
+			return;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	fprintf(stderr, "Could not connect to partition %d at %s\n", k, socketPaths[k]);
+	exit(1);
+}
+
+void sendLine(partitionConn *conn, char *line){
+	fputs(line, conn->out);
+	fputc('\n', conn->out);
+	fflush(conn->out);
+}
+
+void readReply(partitionConn *conn, char *reply, int size){
+	if(fgets(reply, size, conn->in) == NULL){
+		fprintf(stderr, "A partition server went away\n");
+		exit(1);
+	}
+	reply[strcspn(reply, "\n")] = '\0';
+}
+
+//Hand a result with the usual TIME columns to the writer
+void finishRequest(request *req, char *text){
+	struct timeval finished;
+	char result[256];
+	gettimeofday(&finished, NULL);
+	int len = sprintf(result, "%d %s TIME %d.%06d %d.%06d\n", req->requestId, text, (int) req->timeStart.tv_sec, (int) req->timeStart.tv_usec, (int) finished.tv_sec, (int) finished.tv_usec);
+	resultWrite(req->requestId, result, len, 1);
+}
+
+void * coordinate(){
+	partitionConn conns[partitions];
+	int i, j;
+	for(i=0; i<partitions; i++){
+		connectPartition(i, &conns[i]);
+	}
+
+	while(running || q->front != NULL){
+		pthread_mutex_lock(&queueMutex);
+		while(running && q->front == NULL){
+			pthread_cond_wait(&queueNotEmpty, &queueMutex);
+		}
+		if(q->front == NULL){
+			pthread_mutex_unlock(&queueMutex);
+			continue;
+		}
+		request req = pop();
+		pthread_mutex_unlock(&queueMutex);
+
+		int spaces = countSpaces(req.command);
+		char **command = commandRoom(spaces+2);
+		int parts = splitCommand(req.command, command, spaces);
+
+		if(parts == 0){
+			resultWrite(req.requestId, NULL, 0, 1);
+		}
+		else if(strcmp(command[0], "CHECKALL") == 0 || (strcmp(command[0], "CHECK") == 0 && (parts > 2 || (parts == 2 && strchr(command[1]+1, '-'))))){
+			int first = 1, last = numAccounts, count = 0;
+			int *ids;
+			if(strcmp(command[0], "CHECKALL") == 0 || sscanf(command[1], "%d-%d", &first, &last) == 2){
+				first = first < 1 ? 1 : first;
+				last = last > numAccounts ? numAccounts : last;
+				ids = malloc((last >= first ? last-first+1 : 1)*sizeof(int));
+				for(j=first; j<=last; j++){
+					ids[count] = j;
+					count++;
+				}
+			} else {
+				ids = malloc(parts*sizeof(int));
+				for(j=1; j<parts; j++){
+					int accountNum = atoi(command[j]);
+					if(accountNum >= 1 && accountNum <= numAccounts){
+						ids[count] = accountNum;
+						count++;
+					}
+				}
+				count = sortAccounts(ids, count);
+			}
+			routeBulkCheck(conns, &req, ids, count);
+			free(ids);
+		}
+		else if(strcmp(command[0], "CHECK") == 0 && parts == 2){
+			routeCheck(conns, &req, atoi(command[1]));
+		}
+		else if(strcmp(command[0], "TRANS") == 0){
+			routeTrans(conns, &req, command, parts);
+		}
+		else{
+			resultWrite(req.requestId, NULL, 0, 1);
+		}
+		free(req.command);
+	}
+
+	for(i=0; i<partitions; i++){
+		fclose(conns[i].in);
+		fclose(conns[i].out);
+	}
+	return NULL;
+}
+
+void routeCheck(partitionConn *conns, request *req, int accountNum){
+	char line[64], reply[64], text[64];
+	sprintf(line, "CHECK %d", accountNum);
+	sendLine(&conns[partitionOf(accountNum)], line);
+	readReply(&conns[partitionOf(accountNum)], reply, sizeof(reply));
+	sprintf(text, "BAL %d", atoi(reply+4));
+	finishRequest(req, text);
+}
+
+//Ask every partition involved for its part of the sorted ids at once, then write one block
+void routeBulkCheck(partitionConn *conns, request *req, int *ids, int count){
+	int starts[partitions+1];
+	//A CHECKALL of millions of accounts doesn't fit on the stack
+	int *values = malloc((count > 0 ? count : 1)*sizeof(int));
+	int k, j;
+
+	//The ids are sorted, so each partition's ids are next to each other
+	j = 0;
+	for(k=0; k<partitions; k++){
+		starts[k] = j;
+		while(j < count && partitionOf(ids[j]) == k){
+			j++;
+		}
+	}
+	starts[partitions] = count;
+
+	for(k=0; k<partitions; k++){
+		if(starts[k+1] > starts[k]){
+			fprintf(conns[k].out, "READ");
+			for(j=starts[k]; j<starts[k+1]; j++){
+				fprintf(conns[k].out, " %d", ids[j]);
+			}
+			fprintf(conns[k].out, "\n");
+			fflush(conns[k].out);
+		}
+	}
+	for(k=0; k<partitions; k++){
+		if(starts[k+1] > starts[k]){
+			char *reply = NULL;
+			size_t size = 0;
+			if(getline(&reply, &size, conns[k].in) == -1){
+				fprintf(stderr, "A partition server went away\n");
+				exit(1);
+			}
+			char *p = reply+6;
+			for(j=starts[k]; j<starts[k+1]; j++){
+				values[j] = strtol(p, &p, 10);
+			}
+			free(reply);
+		}
+	}
+
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+	char *block = malloc(64 + count*24);
+	int len = sprintf(block, "%d BALS %d TIME %d.%06d %d.%06d\n", req->requestId, count, (int) req->timeStart.tv_sec, (int) req->timeStart.tv_usec, (int) finished.tv_sec, (int) finished.tv_usec);
+	for(j=0; j<count; j++){
+		len += sprintf(block+len, "%d %d\n", ids[j], values[j]);
+	}
+	resultWrite(req->requestId, block, len, 1);
+	free(block);
+	free(values);
+}
+
+//A TRANS on one partition is sent as is, one spanning several partitions is committed with two phase commit
+void routeTrans(partitionConn *conns, request *req, char **command, int parts){
+	int pairs = (parts-1)/2;
+	int *accountNums = pairsRoom(pairs+1, 2);
+	int *amounts = accountNums+pairs+1;
+	int involved[partitions];
+	char *lines[partitions];
+	int numInvolved = 0;
+	char reply[64], text[64];
+	int k, j;
+
+	parseTrans(command, parts, accountNums, amounts);
+	for(k=0; k<partitions; k++){
+		lines[k] = NULL;
+	}
+	for(j=0; j<pairs; j++){
+		k = partitionOf(accountNums[j]);
+		if(lines[k] == NULL){
+			lines[k] = malloc(32 + pairs*24);
+			strcpy(lines[k], "PREPARE");
+			involved[numInvolved] = k;
+			numInvolved++;
+		}
+		sprintf(lines[k]+strlen(lines[k]), " %d %d", accountNums[j], amounts[j]);
+	}
+
+	if(numInvolved <= 1){
+		//Nothing to coordinate, the partition runs the whole transaction
+		if(numInvolved == 1){
+			k = involved[0];
+			memcpy(lines[k]+2, "TRANS", 5);
+			sendLine(&conns[k], lines[k]+2);
+			readReply(&conns[k], reply, sizeof(reply));
+		} else {
+			strcpy(reply, "OK");
+		}
+		finishRequest(req, reply);
+	} else {
+		//Prepare the partitions in increasing order, the same order every coordinator locks them in
+		sortAccounts(involved, numInvolved);
+		int prepared = 0;
+		int isf = 0;
+		for(j=0; j<numInvolved && !isf; j++){
+			k = involved[j];
+			sendLine(&conns[k], lines[k]);
+			readReply(&conns[k], reply, sizeof(reply));
+			if(strcmp(reply, "YES") == 0){
+				prepared++;
+			} else {
+				isf = atoi(reply+3);
+			}
+		}
+
+		//Every partition voted yes, or one of them didn't and the others give up what they prepared
+		for(j=0; j<prepared; j++){
+			sendLine(&conns[involved[j]], isf ? "ABORT" : "COMMIT");
+		}
+		for(j=0; j<prepared; j++){
+			readReply(&conns[involved[j]], reply, sizeof(reply));
+		}
+		if(isf){
+			sprintf(text, "ISF %d", isf);
+			finishRequest(req, text);
+		} else {
+			finishRequest(req, "OK");
+		}
+	}
+
+	for(k=0; k<partitions; k++){
+		free(lines[k]);
+	}
+}
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "appserver.h"
+#include "bulkio.h"
+#include "pipeline.h"
+#include "results.h"
+#include "snapshot.h"
+
+unsigned long long monotonicNs();
+
+//Balances the child converts and writes at a time
+#define SNAPSHOT_WRITE 16384
+
+//The request a worker is on, 0 when it has none
+typedef struct workerSlot{
+	int requestId;
+	struct workerSlot *next;
+} workerSlot;
+
+//A snapshot being written by its child
+typedef struct snapshotJob{
+	pid_t child;
+	int requestId;
+	int through;
+	struct timeval timeStart;
+	unsigned long long forked;
+	double pause;
+	char path[1024];
+} snapshotJob;
+
+//This is the function that waits for a snapshot's child
+void * waitSnapshot(void *arg);
+
+pthread_rwlock_t snapshotLock;
+int snapshotAccounts;
+workerSlot *allSlots = NULL;
+pthread_mutex_t slotsListMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread workerSlot *mySlot = NULL;
+
+//Snapshots still being written
+int snapshotsRunning = 0;
+pthread_mutex_t snapshotsMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t snapshotsDone = PTHREAD_COND_INITIALIZER;
+
+void snapshotInit(int count){
+	snapshotAccounts = count;
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	//With the default a steady stream of transactions could keep a snapshot out forever
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&snapshotLock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+
+void snapshotWorker(){
+	workerSlot *slot = calloc(1, sizeof(workerSlot));
+	pthread_mutex_lock(&slotsListMutex);
+	slot->next = allSlots;
+	allSlots = slot;
+	pthread_mutex_unlock(&slotsListMutex);
+	mySlot = slot;
+}
+
+void snapshotRequest(int requestId){
+	if(mySlot){
+		__atomic_store_n(&mySlot->requestId, requestId, __ATOMIC_RELAXED);
+	}
+}
+
+void snapshotWriteBegin(){
+	pthread_rwlock_rdlock(&snapshotLock);
+}
+
+void snapshotWriteEnd(){
+	pthread_rwlock_unlock(&snapshotLock);
+}
+
+//Find the newest request ID with every request up to it finished, called with writes held off and the queue locked
+int throughId(){
+	int lowest = 0;
+	request *queued;
+	for(queued=q->front; queued!=NULL; queued=queued->next){
+		if(lowest == 0 || queued->requestId < lowest){
+			lowest = queued->requestId;
+		}
+	}
+	pthread_mutex_lock(&slotsListMutex);
+	workerSlot *slot;
+	for(slot=allSlots; slot!=NULL; slot=slot->next){
+		int requestId = __atomic_load_n(&slot->requestId, __ATOMIC_RELAXED);
+		//The snapshot's own request doesn't write anything
+		if(slot != mySlot && requestId > 0 && (lowest == 0 || requestId < lowest)){
+			lowest = requestId;
+		}
+	}
+	pthread_mutex_unlock(&slotsListMutex);
+	//Requests handed on to the pipeline stages are no longer on any worker
+	int staged = pipelineOldest();
+	if(staged > 0 && (lowest == 0 || staged < lowest)){
+		lowest = staged;
+	}
+	return lowest > 0 ? lowest-1 : lastPushedId;
+}
+
+//Write the balances as one run per SNAPSHOT_WRITE accounts and then the metadata run in the child,
+//only plain system calls from here on
+int writeImage(int fd, int through){
+	int values[SNAPSHOT_WRITE];
+	char block[8 + SNAPSHOT_WRITE*4];
+	int first, j;
+
+	if(write(fd, "BANKBAL1", 8) != 8){
+		return 0;
+	}
+	for(first=1; first<=snapshotAccounts; first+=SNAPSHOT_WRITE){
+		int n = snapshotAccounts-first+1 < SNAPSHOT_WRITE ? snapshotAccounts-first+1 : SNAPSHOT_WRITE;
+		//Sparse accounts that were never written are left out, they are 0 in a server the image is loaded into
+		if(!copy_values(first, n, values)){
+			continue;
+		}
+		writeLE32(block, first);
+		writeLE32(block+4, n);
+		for(j=0; j<n; j++){
+			writeLE32(block+8+j*4, values[j]);
+		}
+		if(write(fd, block, 8+n*4) != 8+n*4){
+			return 0;
+		}
+	}
+	writeLE32(block, 0);
+	writeLE32(block+4, 1);
+	writeLE32(block+8, through);
+	return write(fd, block, 12) == 12 && fsync(fd) == 0;
+}
+
+void startSnapshot(int requestId, struct timeval timeStart, char *path){
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(fd < 0){
+		struct timeval finished;
+		gettimeofday(&finished, NULL);
+		char result[128];
+		int len = resultEncode(result, requestId, RESULT_ERROR, ERROR_CREATE, 0, timeStart, finished);
+		resultWrite(requestId, result, len, 1);
+		return;
+	}
+
+	snapshotJob *job = malloc(sizeof(snapshotJob));
+	job->requestId = requestId;
+	job->timeStart = timeStart;
+	strncpy(job->path, path, sizeof(job->path)-1);
+	job->path[sizeof(job->path)-1] = '\0';
+
+	//Hold off the writers and the queue just long enough to find the through ID and fork
+	unsigned long long start = monotonicNs();
+	pthread_rwlock_wrlock(&snapshotLock);
+	pthread_mutex_lock(&queueMutex);
+	job->through = throughId();
+	pthread_mutex_unlock(&queueMutex);
+	job->child = fork();
+	if(job->child == 0){
+		_exit(writeImage(fd, job->through) ? 0 : 1);
+	}
+	pthread_rwlock_unlock(&snapshotLock);
+	job->forked = monotonicNs();
+	job->pause = (job->forked - start)/1e6;
+	close(fd);
+
+	pthread_mutex_lock(&snapshotsMutex);
+	snapshotsRunning++;
+	pthread_mutex_unlock(&snapshotsMutex);
+
+	pthread_t thread;
+	if(job->child < 0 || pthread_create(&thread, NULL, waitSnapshot, job) != 0){
+		waitSnapshot(job);
+	} else {
+		pthread_detach(thread);
+	}
+}
+
+//Wait for the child to write the file and then give the snapshot its result
+void * waitSnapshot(void *arg){
+	snapshotJob *job = arg;
+	int status = 1;
+	if(job->child > 0){
+		waitpid(job->child, &status, 0);
+	}
+	double writing = (monotonicNs() - job->forked)/1e9;
+	int ok = job->child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	struct timeval finished;
+	gettimeofday(&finished, NULL);
+	char result[128];
+	int len;
+	if(ok){
+		len = resultEncode(result, job->requestId, RESULT_SNAPSHOT, snapshotAccounts, job->through, job->timeStart, finished);
+		fprintf(stderr, "SNAPSHOT %s: %d accounts through request %d, writes paused %.3f ms, written in %.3f s\n", job->path, snapshotAccounts, job->through, job->pause, writing);
+	} else {
+		len = resultEncode(result, job->requestId, RESULT_ERROR, ERROR_SNAPSHOT, 0, job->timeStart, finished);
+	}
+	resultWrite(job->requestId, result, len, 1);
+	free(job);
+
+	pthread_mutex_lock(&snapshotsMutex);
+	snapshotsRunning--;
+	pthread_cond_broadcast(&snapshotsDone);
+	pthread_mutex_unlock(&snapshotsMutex);
+	return NULL;
+}
+
+void snapshotClose(){
+	pthread_mutex_lock(&snapshotsMutex);
+	while(snapshotsRunning > 0){
+		pthread_cond_wait(&snapshotsDone, &snapshotsMutex);
+	}
+	pthread_mutex_unlock(&snapshotsMutex);
+}
@@ -0,0 +1,33 @@
+#include <sys/time.h>
+
+/*
+ * Point in time snapshots
+ * SNAPSHOT <file> writes every balance as it was at one moment, in the binary format LOAD reads.
+ * Requests that write balances hold the snapshot lock shared while they do. A snapshot takes it
+ * exclusively just long enough to fork, and the child writes its copy-on-write image of the
+ * balances in the background while the workers carry on.
+ *
+ * The file ends with a metadata run at account 0 holding the snapshot's "through" request ID:
+ * every request with an ID up to it had finished when the snapshot was taken, and none after
+ * it was still in the middle of a write.
+ */
+
+//Set up the snapshot lock for accounts 1 to count, it lets a waiting snapshot in ahead of new writers
+void snapshotInit(int count);
+
+//Register the calling thread as a worker whose requests decide the through ID
+void snapshotWorker();
+
+//Record the request the calling worker took, 0 when it is done, called with the queue locked
+void snapshotRequest(int requestId);
+
+//Bracket the part of a request that writes balances, taken only while the accounts are held
+//so a snapshot waits for the writes in progress and never for a request waiting on a lock
+void snapshotWriteBegin();
+void snapshotWriteEnd();
+
+//Take a snapshot, its result is written once the file is
+void startSnapshot(int requestId, struct timeval timeStart, char *path);
+
+//Wait for the snapshots still being written
+void snapshotClose();
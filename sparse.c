@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include "sparse.h"
+
+sparseArray * sparseNew(long count, int entrySize, void (*initPage)(void *page, int entries)){
+	sparseArray *array = malloc(sizeof(sparseArray));
+	array->numPages = (count + SPARSE_PAGE_ENTRIES - 1) >> SPARSE_PAGE_BITS;
+	//Untouched parts of the table are never written, so the system doesn't back them with memory either
+	array->pages = calloc(array->numPages, sizeof(void*));
+	array->entrySize = entrySize;
+	array->initPage = initPage;
+	array->pagesUsed = 0;
+	return array;
+}
+
+//Allocate the page for a slot, two threads may race to do it and only one page is kept
+char * sparseMaterialize(sparseArray *array, void **slot){
+	char *page = calloc(SPARSE_PAGE_ENTRIES, array->entrySize);
+	if(array->initPage){
+		array->initPage(page, SPARSE_PAGE_ENTRIES);
+	}
+	void *expected = NULL;
+	if(!__atomic_compare_exchange_n(slot, &expected, page, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		free(page);
+		return expected;
+	}
+	__sync_fetch_and_add(&array->pagesUsed, 1);
+	return page;
+}
+
+void * sparseAt(sparseArray *array, long index){
+	void **slot = &array->pages[index >> SPARSE_PAGE_BITS];
+	char *page = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if(page == NULL){
+		page = sparseMaterialize(array, slot);
+	}
+	return page + (index & (SPARSE_PAGE_ENTRIES-1)) * array->entrySize;
+}
+
+void * sparsePeek(sparseArray *array, long index){
+	char *page = __atomic_load_n(&array->pages[index >> SPARSE_PAGE_BITS], __ATOMIC_ACQUIRE);
+	return page ? page + (index & (SPARSE_PAGE_ENTRIES-1)) * array->entrySize : NULL;
+}
+
+long sparseBytes(sparseArray *array){
+	return array->numPages*sizeof(void*) + __atomic_load_n(&array->pagesUsed, __ATOMIC_RELAXED)*SPARSE_PAGE_ENTRIES*array->entrySize;
+}
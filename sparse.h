@@ -0,0 +1,29 @@
+/*
+ * Sparse arrays
+ * A two level radix table, the top bits of an index pick a page and the low SPARSE_PAGE_BITS pick
+ * the entry in it. Pages are allocated the first time one of their entries is touched, so a huge
+ * index range only costs the table of page pointers until it is used. Entries start out zero.
+ */
+
+#define SPARSE_PAGE_BITS 8
+#define SPARSE_PAGE_ENTRIES (1 << SPARSE_PAGE_BITS)
+
+typedef struct sparseArray{
+	void **pages;
+	long numPages;
+	int entrySize;
+	void (*initPage)(void *page, int entries);
+	long pagesUsed;
+} sparseArray;
+
+//Set up an array of count entries of entrySize bytes, initPage sets up each new page after it is zeroed (NULL if zero is enough)
+sparseArray * sparseNew(long count, int entrySize, void (*initPage)(void *page, int entries));
+
+//Find an entry, allocating its page if it wasn't yet
+void * sparseAt(sparseArray *array, long index);
+
+//Find an entry, returns NULL if its page was never touched
+void * sparsePeek(sparseArray *array, long index);
+
+//Bytes allocated for the table and its pages so far
+long sparseBytes(sparseArray *array);
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "Bank.h"
+#include "storage.h"
+#include "timing.h"
+
+//A set of storage calls made for one request, the caller waits until all of them are back
+typedef struct storageBatch{
+	int remaining;
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+} storageBatch;
+
+//One read or write for the I/O threads to make, of one account or a batch of them
+typedef struct storageJob{
+	int write;
+	int *ids;
+	int n;
+	int *values;
+	storageBatch *batch;
+	struct storageJob *next;
+} storageJob;
+
+//This is the function the storage I/O threads run
+void * storageWorker();
+
+int ioThreads = 0;
+storageJob *jobsFront = NULL;
+storageJob *jobsRear = NULL;
+pthread_mutex_t jobsMutex;
+pthread_cond_t jobsReady;
+
+void storageInit(int threads){
+	int i;
+	ioThreads = threads;
+	pthread_mutex_init(&jobsMutex, NULL);
+	pthread_cond_init(&jobsReady, NULL);
+	for(i=0; i<threads; i++){
+		pthread_t thread;
+		pthread_create(&thread, NULL, storageWorker, NULL);
+		pthread_detach(thread);
+	}
+}
+
+//Make one storage call
+void runJob(storageJob *job){
+	if(job->n > 1){
+		if(job->write){
+			write_accounts(job->ids, job->n, job->values);
+		} else {
+			read_accounts(job->ids, job->n, job->values);
+		}
+	} else if(job->write){
+		write_account(job->ids[0], job->values[0]);
+	} else {
+		job->values[0] = read_account(job->ids[0]);
+	}
+}
+
+void * storageWorker(){
+	while(1){
+		pthread_mutex_lock(&jobsMutex);
+		while(jobsFront == NULL){
+			pthread_cond_wait(&jobsReady, &jobsMutex);
+		}
+		storageJob *job = jobsFront;
+		jobsFront = job->next;
+		if(!jobsFront){
+			jobsRear = NULL;
+		}
+		pthread_mutex_unlock(&jobsMutex);
+
+		//Grab the batch before running the job, the caller may return as soon as the last job is counted
+		storageBatch *batch = job->batch;
+		runJob(job);
+		pthread_mutex_lock(&batch->mutex);
+		batch->remaining--;
+		if(batch->remaining == 0){
+			pthread_cond_signal(&batch->done);
+		}
+		pthread_mutex_unlock(&batch->mutex);
+	}
+	return NULL;
+}
+
+//Hand every call but the first to the I/O threads, make the first one ourselves and wait for the rest
+void storageRun(int write, int *ids, int n, int *values){
+	int i;
+	//Past STORAGE_BATCH_OVER accounts a call covers a batch of them, so a huge TRANS costs calls in proportion to its size
+	int per = n > STORAGE_BATCH_OVER ? STORAGE_BATCH : 1;
+	int calls = (n+per-1)/per;
+	//A TRANS without pairs gets here with no accounts at all
+	if(ioThreads == 0 || calls <= 1){
+		for(i=0; i<calls; i++){
+			storageJob job = {write, &ids[i*per], n-i*per < per ? n-i*per : per, &values[i*per], NULL, NULL};
+			runJob(&job);
+		}
+		return;
+	}
+
+	storageBatch batch;
+	storageJob jobs[calls];
+	batch.remaining = calls-1;
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.done, NULL);
+	for(i=0; i<calls; i++){
+		jobs[i].write = write;
+		jobs[i].ids = &ids[i*per];
+		jobs[i].n = n-i*per < per ? n-i*per : per;
+		jobs[i].values = &values[i*per];
+		jobs[i].batch = &batch;
+		jobs[i].next = i+1 < calls ? &jobs[i+1] : NULL;
+	}
+
+	pthread_mutex_lock(&jobsMutex);
+	if(jobsRear){
+		jobsRear->next = &jobs[1];
+	} else {
+		jobsFront = &jobs[1];
+	}
+	jobsRear = &jobs[calls-1];
+	pthread_cond_broadcast(&jobsReady);
+	pthread_mutex_unlock(&jobsMutex);
+
+	runJob(&jobs[0]);
+
+	pthread_mutex_lock(&batch.mutex);
+	while(batch.remaining > 0){
+		pthread_cond_wait(&batch.done, &batch.mutex);
+	}
+	pthread_mutex_unlock(&batch.mutex);
+	pthread_mutex_destroy(&batch.mutex);
+	pthread_cond_destroy(&batch.done);
+}
+
+void storageReadAll(int *ids, int n, int *values){
+	int previous = timingEnter(STATE_BANK);
+	storageRun(0, ids, n, values);
+	timingLeave(previous);
+}
+
+void storageWriteAll(int *ids, int n, int *values){
+	int previous = timingEnter(STATE_BANK);
+	storageRun(1, ids, n, values);
+	timingLeave(previous);
+}
+
+void storageReadBatch(int *ids, int n, int *values){
+	int previous = timingEnter(STATE_BANK);
+	read_accounts(ids, n, values);
+	timingLeave(previous);
+}
+
+void storageWriteBatch(int *ids, int n, int *values){
+	int previous = timingEnter(STATE_BANK);
+	write_accounts(ids, n, values);
+	timingLeave(previous);
+}
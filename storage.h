@@ -0,0 +1,16 @@
+//Start the storage I/O threads, with 0 threads every storage call is made by the caller one after another
+void storageInit(int threads);
+
+//Above this many accounts storageReadAll and storageWriteAll make one call per STORAGE_BATCH accounts instead of one per account
+#define STORAGE_BATCH_OVER 64
+#define STORAGE_BATCH 256
+
+//Read accounts ids[0..n-1] into values, the calls are issued concurrently
+void storageReadAll(int *ids, int n, int *values);
+
+//Write values into accounts ids[0..n-1], the calls are issued concurrently
+void storageWriteAll(int *ids, int n, int *values);
+
+//Read or write accounts ids[0..n-1] with a single batched storage call
+void storageReadBatch(int *ids, int n, int *values);
+void storageWriteBatch(int *ids, int n, int *values);
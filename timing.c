@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include "timing.h"
+
+//One worker's clock and counters, only written by the worker but read by metrics at any time
+typedef struct workerClock{
+	int worker;
+	int state;
+	unsigned long long since;
+	unsigned long long ns[NUM_STATES];
+	long requests[NUM_REQUEST_TYPES];
+	long transOk;
+	long transIsf;
+	struct workerClock *next;
+} workerClock;
+
+char *stateNames[NUM_STATES] = {"idle", "parse", "lock", "bank", "output", "other"};
+char *requestNames[NUM_REQUEST_TYPES] = {"check", "bulk_check", "trans", "load", "dump", "other"};
+
+int timing = 0;
+int numWorkers = 0;
+workerClock *allClocks = NULL;
+//Only taken to register a worker and to walk the list, never while a worker is serving a request
+pthread_mutex_t clocksMutex = PTHREAD_MUTEX_INITIALIZER;
+__thread workerClock *myClock = NULL;
+
+#define STAT_ADD(field, amount) __atomic_store_n(&(field), (field)+(amount), __ATOMIC_RELAXED)
+#define STAT_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+unsigned long long timingClock(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+void timingInit(){
+	timing = 1;
+}
+
+void timingWorker(){
+	if(!timing){
+		return;
+	}
+	workerClock *clock = calloc(1, sizeof(workerClock));
+	clock->state = STATE_IDLE;
+	clock->since = timingClock();
+	pthread_mutex_lock(&clocksMutex);
+	clock->worker = numWorkers;
+	numWorkers++;
+	clock->next = allClocks;
+	allClocks = clock;
+	pthread_mutex_unlock(&clocksMutex);
+	myClock = clock;
+}
+
+void timingSet(int state){
+	workerClock *clock = myClock;
+	if(clock == NULL || clock->state == state){
+		return;
+	}
+	unsigned long long now = timingClock();
+	STAT_ADD(clock->ns[clock->state], now-clock->since);
+	__atomic_store_n(&clock->since, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock->state, state, __ATOMIC_RELAXED);
+}
+
+int timingEnter(int state){
+	if(myClock == NULL){
+		return -1;
+	}
+	int previous = myClock->state;
+	timingSet(state);
+	return previous;
+}
+
+void timingLeave(int previous){
+	if(previous >= 0){
+		timingSet(previous);
+	}
+}
+
+void timingRequest(int type){
+	if(myClock){
+		STAT_ADD(myClock->requests[type], 1);
+	}
+}
+
+void timingTrans(int isf){
+	if(myClock == NULL){
+		return;
+	}
+	if(isf){
+		STAT_ADD(myClock->transIsf, 1);
+	} else {
+		STAT_ADD(myClock->transOk, 1);
+	}
+}
+
+//Time a worker has spent in a state, counting the time it has been in its current one
+unsigned long long stateNs(workerClock *clock, int state, unsigned long long now){
+	unsigned long long ns = STAT_READ(clock->ns[state]);
+	if(STAT_READ(clock->state) == state){
+		unsigned long long since = STAT_READ(clock->since);
+		if(now > since){
+			ns += now-since;
+		}
+	}
+	return ns;
+}
+
+void timingMetrics(FILE *out){
+	if(!timing){
+		return;
+	}
+	unsigned long long now = timingClock();
+	long requests[NUM_REQUEST_TYPES] = {0};
+	long transOk = 0;
+	long transIsf = 0;
+	int s;
+
+	fprintf(out, "# HELP bank_worker_seconds_total Time each worker has spent in each state.\n");
+	fprintf(out, "# TYPE bank_worker_seconds_total counter\n");
+	pthread_mutex_lock(&clocksMutex);
+	workerClock *clock;
+	for(clock=allClocks; clock!=NULL; clock=clock->next){
+		for(s=0; s<NUM_STATES; s++){
+			fprintf(out, "bank_worker_seconds_total{worker=\"%d\",state=\"%s\"} %.6f\n", clock->worker, stateNames[s], stateNs(clock, s, now)/1e9);
+		}
+		for(s=0; s<NUM_REQUEST_TYPES; s++){
+			requests[s] += STAT_READ(clock->requests[s]);
+		}
+		transOk += STAT_READ(clock->transOk);
+		transIsf += STAT_READ(clock->transIsf);
+	}
+	pthread_mutex_unlock(&clocksMutex);
+
+	fprintf(out, "# HELP bank_requests_total Requests served by kind.\n");
+	fprintf(out, "# TYPE bank_requests_total counter\n");
+	for(s=0; s<NUM_REQUEST_TYPES; s++){
+		fprintf(out, "bank_requests_total{type=\"%s\"} %ld\n", requestNames[s], requests[s]);
+	}
+	fprintf(out, "# HELP bank_trans_total Transactions by outcome, the ISF rate is isf over the sum.\n");
+	fprintf(out, "# TYPE bank_trans_total counter\n");
+	fprintf(out, "bank_trans_total{result=\"ok\"} %ld\n", transOk);
+	fprintf(out, "bank_trans_total{result=\"isf\"} %ld\n", transIsf);
+}
+
+void timingReport(FILE *out){
+	if(!timing){
+		return;
+	}
+	unsigned long long now = timingClock();
+	unsigned long long total[NUM_STATES] = {0};
+	unsigned long long sum = 0;
+	long transOk = 0;
+	long transIsf = 0;
+	int s;
+
+	pthread_mutex_lock(&clocksMutex);
+	workerClock *clock;
+	for(clock=allClocks; clock!=NULL; clock=clock->next){
+		for(s=0; s<NUM_STATES; s++){
+			total[s] += stateNs(clock, s, now);
+		}
+		transOk += clock->transOk;
+		transIsf += clock->transIsf;
+	}
+	pthread_mutex_unlock(&clocksMutex);
+
+	for(s=0; s<NUM_STATES; s++){
+		sum += total[s];
+	}
+	fprintf(out, "worker time:");
+	for(s=0; s<NUM_STATES; s++){
+		fprintf(out, " %s %.1f%%", stateNames[s], sum ? 100.0*total[s]/sum : 0);
+	}
+	fprintf(out, ", %ld transactions, %.1f%% ISF\n", transOk+transIsf, transOk+transIsf ? 100.0*transIsf/(transOk+transIsf) : 0);
+}
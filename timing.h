@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+/*
+ * Worker time accounting
+ * Each worker's time goes to the state it is in. Waits nest, timingEnter switches to a state
+ * and returns the one to go back to with timingLeave. A thread that isn't a registered worker,
+ * or any thread while accounting is off, skips all of it.
+ */
+
+enum {STATE_IDLE, STATE_PARSE, STATE_LOCK, STATE_BANK, STATE_OUTPUT, STATE_OTHER, NUM_STATES};
+
+//Kinds of requests counted
+enum {REQ_CHECK, REQ_BULK_CHECK, REQ_TRANS, REQ_LOAD, REQ_DUMP, REQ_OTHER, NUM_REQUEST_TYPES};
+
+//Turn on time accounting
+void timingInit();
+
+//Register the calling thread as a worker, it starts out idle
+void timingWorker();
+
+//Move the calling worker to a state
+void timingSet(int state);
+int timingEnter(int state);
+void timingLeave(int previous);
+
+//Count a request by its kind, and a TRANS by whether it was ISF
+void timingRequest(int type);
+void timingTrans(int isf);
+
+//Write every worker's states and the request counters as Prometheus text
+void timingMetrics(FILE *out);
+
+//Write where the workers spent their time, summed over all of them
+void timingReport(FILE *out);
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+#define TRACE_MAGIC "BANKTRC1"
+
+//Arrival time of the last recorded line
+unsigned long long lastArrival;
+
+//Current time on the monotonic clock in nanoseconds
+unsigned long long monotonicNs(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+void writeVarint(FILE *trace, unsigned long long value){
+	while(value >= 0x80){
+		fputc((value & 0x7f) | 0x80, trace);
+		value >>= 7;
+	}
+	fputc(value, trace);
+}
+
+//Returns 0 if the trace ended in the middle of the number
+int readVarint(FILE *trace, unsigned long long *value){
+	int shift = 0;
+	int c;
+	*value = 0;
+	while((c = fgetc(trace)) != EOF){
+		*value |= (unsigned long long) (c & 0x7f) << shift;
+		if(!(c & 0x80)){
+			return 1;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+FILE * traceStart(char *path){
+	FILE *trace = fopen(path, "wb");
+	if(trace == NULL){
+		return NULL;
+	}
+	fwrite(TRACE_MAGIC, 1, 8, trace);
+	lastArrival = monotonicNs();
+	return trace;
+}
+
+void traceLine(FILE *trace, char *line){
+	unsigned long long now = monotonicNs();
+	int len = strlen(line);
+	writeVarint(trace, now-lastArrival);
+	writeVarint(trace, len);
+	fwrite(line, 1, len, trace);
+	lastArrival = now;
+}
+
+FILE * traceOpen(char *path){
+	char magic[8];
+	FILE *trace = fopen(path, "rb");
+	if(trace == NULL){
+		return NULL;
+	}
+	if(fread(magic, 1, 8, trace) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0){
+		fclose(trace);
+		return NULL;
+	}
+	return trace;
+}
+
+int traceNext(FILE *trace, traceRecord *rec){
+	unsigned long long len;
+	if(!readVarint(trace, &rec->delta) || !readVarint(trace, &len)){
+		return 0;
+	}
+	rec->len = len;
+	if(rec->len+1 > rec->size){
+		rec->size = rec->len+1;
+		rec->line = realloc(rec->line, rec->size);
+	}
+	if(fread(rec->line, 1, rec->len, trace) != rec->len){
+		return 0;
+	}
+	rec->line[rec->len] = '\0';
+	return 1;
+}
@@ -0,0 +1,28 @@
+#include <stdio.h>
+
+/*
+ * Workload traces
+ * A trace is the 8 byte header "BANKTRC1" followed by one record per ingested line.
+ * Each record is the nanoseconds since the previous record (the first one counts from
+ * when the trace was started) and the line length, both as LEB128 varints, then the line itself.
+ */
+
+//line grows to the longest line read, start a record out zeroed
+typedef struct traceRecord{
+	unsigned long long delta;
+	int len;
+	char *line;
+	int size;
+} traceRecord;
+
+//Start recording to a new trace file, returns NULL if it can't be created
+FILE * traceStart(char *path);
+
+//Append a line with the current monotonic time as its arrival time
+void traceLine(FILE *trace, char *line);
+
+//Open a trace for reading, returns NULL if it can't be opened or isn't a trace
+FILE * traceOpen(char *path);
+
+//Read the next record, returns 0 at the end of the trace
+int traceNext(FILE *trace, traceRecord *rec);